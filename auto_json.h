@@ -5,18 +5,103 @@
 #ifndef AUTO_JSON_H
 #define AUTO_JSON_H
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <istream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <typeinfo>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// jsoncpp only backs the Json::Value document API and the legacy SetMethod/SetDocument mode, text
+// and MessagePack run on the in-tree engine. Define AUTO_JSON_NO_JSONCPP to build without it, other
+// document libraries plug in as a backend, see AutoJson::MarshalDocument.
+#ifndef AUTO_JSON_NO_JSONCPP
 #include "json/json.h"
+#define AUTO_JSON_HAS_JSONCPP 1
+#endif
+#if __cplusplus >= 201703L
+#include <string_view>
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+#endif
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define AUTO_JSON_HAS_TO_CHARS 1
+#endif
+// Numbers are written with the fewest digits that read back to the same value. Define
+// AUTO_JSON_LEGACY_NUMBERS to keep the bytes of Json::FastWriter instead: 17 significant digits,
+// float widened to double.
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define AUTO_JSON_HAS_FD 1
+#else
+#include <fstream>
+#endif
+// Strings are scanned 16 (SSE2) or 32 (AVX2, picked at runtime) bytes at a time on x86 with GCC and
+// Clang. Define AUTO_JSON_NO_SIMD to keep the scalar scanners only.
+#if !defined(AUTO_JSON_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define AUTO_JSON_HAS_SSE2 1
+#endif
 
 enum AutoJsonMethod {
     Default = 0,
     Marshal = 1,
     Unmarshal = 2,
+    Collect = 3,
 };
 
+class AutoJsonHelperBase;
+
 namespace _autojson {
+    /**
+     * A string with any allocator: std::string, std::pmr::string or one over a custom allocator.
+     * Strings, vectors and maps are accepted with any allocator, and elements are constructed in
+     * place in their container so that they share its allocator: members of std::pmr types built
+     * on a request's arena keep the whole unmarshaled graph in that arena.
+     */
+    template <typename A>
+    using BasicString = std::basic_string<char, std::char_traits<char>, A>;
+
+    template <typename K, typename T, typename A>
+    using BasicMap = std::map<K, T, std::less<K>, A>;
+
+    template <typename K, typename T, typename H, typename E, typename A>
+    using HashMap = std::unordered_map<K, T, H, E, A>;
+
+    /**
+     * A flat map: a vector of key/value pairs sorted by key. Unmarshal sorts it and keeps the last
+     * value of a duplicate key, marshal expects unique keys.
+     */
+    template <typename K, typename T, typename A>
+    using FlatMap = std::vector<std::pair<K, T>, A>;
+
     template <typename T>
     struct MarshalHelper_check
     {
@@ -31,372 +116,5586 @@ namespace _autojson {
     };
 
     /**
-     * Generic serialize method for class that has 'SetJsonMapping' function(return an empty string on failure)
-     * @tparam T Derived class of AutoJsonHelper
-     * @param json_string[in,out] JSON result after serializing
-     * @param obj[in] Derived class object of AutoJsonHelper
+     * Mapping of a type declared outside of it, specialized by AUTO_JSON_TYPE_FIELDS
      */
-    template <typename T, typename std::enable_if<MarshalHelper_check<T>::exist,int>::type = 0>
-    inline void _marshal(std::string &json_string, T &obj) {
-        obj.Clear();
-        obj.SetMethod(AutoJsonMethod::Marshal);
-        obj.SetJsonMapping();
-        json_string = obj.GetString();
-    }
+    template <typename T>
+    struct ExternalFields {};
+
+    template <typename T>
+    struct FieldTable_check
+    {
+        // Check if the template class T is declared with AUTO_JSON_FIELDS
+        template <typename U>
+        static constexpr auto check(U *u) -> decltype(U::_auto_json_fields(), std::true_type());
+
+        static constexpr std::false_type check(...);
+
+        static constexpr bool intrusive = std::is_same<decltype(check(std::declval<T *>())), std::true_type>::value;
+        static constexpr bool external =
+            std::is_same<decltype(check(std::declval<ExternalFields<T> *>())), std::true_type>::value;
+        static constexpr bool exist = intrusive || external;
+
+        typedef typename std::conditional<intrusive, T, ExternalFields<T>>::type source;  //!< Holds _auto_json_fields()
+    };
 
     /**
-     * Generic serialize method for class that DOESNT have 'SetJsonMapping' function(return an empty string)
-     * @tparam T Template class
-     * @param json_string[in,out] JSON result
-     * @param obj[in] Object of template class
+     * How a type is mapped, a field table takes precedence over SetJsonMapping
+     */
+    template <typename T>
+    struct Mapping_check
+    {
+        static constexpr bool table = FieldTable_check<T>::exist;
+        static constexpr bool helper = MarshalHelper_check<T>::exist && !table;
+        static constexpr bool exist = table || helper;
+    };
+
+    /**
+     * Compile-time descriptor of a member declared with AUTO_JSON_FIELD
      */
-    template <typename T, typename std::enable_if<!MarshalHelper_check<T>::exist,int>::type = 0>
-    inline void _marshal(std::string &json_string, T &obj) {
-        json_string = std::string{};
+    template <typename C, typename M>
+    struct Field {
+        M C::*member;
+        const char *key;
+        size_t key_length;
+    };
+
+    template <typename C, typename M, size_t N>
+    constexpr Field<C, M> MakeField(M C::*member, const char (&key)[N]) {
+        return Field<C, M>{member, key, N - 1};
     }
 
     /**
-     * Generic deserialize method for class that has 'SetJsonMapping' function(return an empty string on failure)
-     * @tparam T Derived class of AutoJsonHelper
-     * @param json_string[in] The Json needs to be deserialized
-     * @param obj[in,out] Object result after deserializing
+     * Call f(I, field) for every field of the tuple
      */
-    template <typename T, typename std::enable_if<MarshalHelper_check<T>::exist,int>::type = 0>
-    inline void _unmarshal(std::string &json_string, T &obj) {
-        obj.Clear();
-        Json::Reader reader;
-        Json::Value root;
-        obj.SetMethod(AutoJsonMethod::Unmarshal);
-        if (reader.parse(json_string, root) && !root.empty() && root.isObject()) {
-            obj.SetDocument(root);
-            obj.SetJsonMapping();
+    template <size_t I, size_t N>
+    struct FieldEach {
+        template <typename Fields, typename F>
+        static void Apply(const Fields &fields, F &f) {
+            f(I, std::get<I>(fields));
+            FieldEach<I + 1, N>::Apply(fields, f);
         }
-    }
+    };
+
+    template <size_t N>
+    struct FieldEach<N, N> {
+        template <typename Fields, typename F>
+        static void Apply(const Fields & /*fields*/, F & /*f*/) {}
+    };
 
     /**
-     * Generic deserialize method for class that DOESNT have 'SetJsonMapping' function(do nothing)
-     * @tparam T Template class
-     * @param json_string[in] The Json needs to be deserialized
-     * @param obj[in,out] Object result after deserializing
+     * Compile-time list of field indexes, MakeIndexes<N>::type is 0..N-1
      */
-    template <typename T, typename std::enable_if<!MarshalHelper_check<T>::exist,int>::type = 0>
-    inline void _unmarshal(std::string &json_string, T &obj) {}
-}
+    template <size_t... I>
+    struct Indexes {};
+
+    template <size_t N, size_t... I>
+    struct MakeIndexes : MakeIndexes<N - 1, N - 1, I...> {};
+
+    template <size_t... I>
+    struct MakeIndexes<0, I...> {
+        typedef Indexes<I...> type;
+    };
+
+    class Writer;
+    class Parser;
+    class Packer;
+    class Unpacker;
 
-namespace AutoJson {
     /**
-     * Serialize object to JSON string
-     * @param json_string[in,out] JSON result
-     * @param obj[in] Object needs to be serialized
+     * Type-erased operations of a mapped member type, one static table per type
      */
-    template <typename T>
-    inline void Marshal(std::string &json_string, const T &obj) {
-        _autojson::_marshal(json_string, const_cast<T&>(obj));
-    }
+    struct FieldOps {
+        void (*write)(Writer &writer, const void *var);
+        bool (*read)(Parser &parser, void *var);
+        void (*pack)(Packer &packer, const void *var);
+        bool (*unpack)(Unpacker &unpacker, void *var);
+        size_t (*count)(const void *var);   //!< Size of a container, kNoField for other types
+        void (*write_element)(Writer &writer, const void *var, size_t index);
+        bool cached;            //!< Objects and vectors of them, see AutoJson::FragmentCache
+        bool elements_cached;   //!< A vector of cached values, cached element by element
+    };
 
     /**
-     * Deserialized JSON string to object
-     * @param json_string[in] JSON string needs to be deserialized
-     * @param obj[in,out] Object result
+     * A member collected from SetJsonMapping in AutoJsonMethod::Collect mode
      */
-    template <typename T>
-    inline void Unmarshal(std::string &json_string, const T &obj) {
-        _autojson::_unmarshal(json_string, const_cast<T&>(obj));
-    }
-}
+    struct FieldRef {
+        size_t key_offset;      //!< Offset of the key in FieldSink::keys_
+        size_t key_length;
+        size_t seq;             //!< Declaration order, later declarations win on duplicated keys
+        void *var;
+        const FieldOps *ops;
+        size_t next;            //!< Next member of the frame mapped to the same key, see Parser
+    };
 
-/**
- * Specify the mapping between member variables and JSON fields
- */
-#define AUTO_JSON_MAPPING(variable, key)                                \
-    if (AutoJsonMethod::Marshal == this->method_) {                    \
-        _marshal_into_document(variable, key);                         \
-    } else if (AutoJsonMethod::Unmarshal == this->method_) {           \
-        _unmarshal_into_obj(variable, key);                            \
-    }
+    static const size_t kNoField = static_cast<size_t>(-1);
 
-class AutoJsonHelper {
-public:
-    AutoJsonHelper() = default;
-    ~AutoJsonHelper() = default;
-    virtual void SetJsonMapping() = 0;
-    void SetMethod(AutoJsonMethod method) { this->method_ = method; };
-    void SetDocument(const Json::Value &doc) { this->document_ = doc; };
-    Json::Value GetDocument() {return this->document_;};
+#ifdef AUTO_JSON_HAS_JSONCPP
+    typedef Json::Value Document;
+#else
+    struct Document;    // no document API without jsoncpp
+#endif
+
+    class FieldSink;
 
     /**
-     * Convert JSON document to JSON string
-     * @return JSON string
+     * Per-thread state of a SetJsonMapping call driven by the library. The mapped object itself is
+     * never modified, so a shared const object can be serialized from several threads at once.
      */
-    std::string GetString() {
-        Json::FastWriter writer;
+    struct MappingContext {
+        const AutoJsonHelperBase *obj;  //!< Object whose SetJsonMapping is running
+        AutoJsonMethod method;      //!< Collect or Marshal
+        FieldSink *sink;            //!< Where Collect mode pushes the mapped members
+        Document *target;           //!< Node Marshal mode builds the members into
+        MappingContext *prev;
 
-        std::string result = writer.write(this->document_);
-        // if document is empty, return empty string
-        if (this->document_.empty()) {
-            return std::string{};
+        static MappingContext *&Current() {
+            static thread_local MappingContext *current = nullptr;
+            return current;
         }
-        if (!result.empty() && result.back() == '\n') {
-            result.pop_back();
+
+        /**
+         * The context of obj's running SetJsonMapping, nullptr in the legacy SetMethod mode
+         */
+        static const MappingContext *Find(const AutoJsonHelperBase *obj) {
+            const MappingContext *current = Current();
+            return current != nullptr && current->obj == obj ? current : nullptr;
         }
-        return result;
     };
 
     /**
-     * @brief Clear member variables
+     * Call SetJsonMapping. Nested members and container elements are exactly of their static type,
+     * so Exact calls it qualified: resolved at compile time and inlinable even when it is virtual.
+     * A root object may be a derived object passed by base reference and keeps the virtual call.
      */
-    void Clear() {
-        this->document_.clear();
-        this->method_ = AutoJsonMethod::Default;
+    template <bool Exact>
+    struct MappingCall {
+        template <typename T>
+        static void Run(T &obj) { obj.T::SetJsonMapping(); }
     };
 
-protected:
-    AutoJsonMethod method_ = AutoJsonMethod::Default; //!< Method Type. 0=>Not Init, 1=>Serialize, 2=>Deserialize
+    template <>
+    struct MappingCall<false> {
+        template <typename T>
+        static void Run(T &obj) { obj.SetJsonMapping(); }
+    };
 
     /**
-     * Serialize variable into JSON according to the specified keys
+     * Run obj's SetJsonMapping inside a context, restoring the enclosing one afterwards
      */
-    template <typename T>
-    void _marshal_into_document(T &var, const std::string &json_key);
+    template <bool Exact, typename T>
+    inline void _map_with_context(const T &obj, AutoJsonMethod method, FieldSink *sink, Document *target) {
+        MappingContext context = {&obj, method, sink, target, MappingContext::Current()};
+        MappingContext::Current() = &context;
+        // SetJsonMapping is not const but only reads the object in these modes
+        MappingCall<Exact>::Run(const_cast<T &>(obj));
+        MappingContext::Current() = context.prev;
+    }
 
     /**
-     * Deserialize JSON into variable according to the specified keys
+     * Seeded FNV-1a hash of an object key
      */
+    inline uint32_t KeyHash(const char *key, size_t length, uint32_t seed) {
+        uint32_t hash = 2166136261u ^ seed;
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= static_cast<unsigned char>(key[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
     template <typename T>
-    void _unmarshal_into_obj(T &var, const std::string &json_key);
+    inline void _write_field(Writer &writer, const void *var);
 
-private:
+    template <typename T>
+    inline bool _read_field(Parser &parser, void *var);
 
-    template <typename T, typename std::enable_if<_autojson::MarshalHelper_check<T>::exist,int>::type = 0>
-    inline bool _marshal_for_spl_(T &obj, Json::Value &dc) {
-        obj.Clear();
-        obj.SetMethod(AutoJsonMethod::Marshal);
-        obj.SetJsonMapping();
-        dc = obj.GetDocument();
-        return true;
-    }
+    template <typename T>
+    inline void _pack_field(Packer &packer, const void *var);
 
-    template <typename T, typename std::enable_if<!_autojson::MarshalHelper_check<T>::exist,int>::type = 0>
-    inline bool _marshal_for_spl_(T &obj, Json::Value &dc) {
-        this->_marshal_into_document_(obj, dc);
-        return true;
-    }
+    template <typename T>
+    inline bool _unpack_field(Unpacker &unpacker, void *var);
+
+    template <typename T>
+    inline void _write_element(Writer &writer, const void *var, size_t index);
 
     /**
-     * Serialize core function
-     * @tparam T Basic data types other than map, vector, etc., from the STL.
-     * @param var[in] Value needs to be serialized
-     * @param dc[in,out] The Document that Value is serialized into
+     * How AutoJson::FragmentCache keeps the encoded bytes of a member of type T. Objects and vectors
+     * of them are cached. Scalars, strings, maps and vectors of those are not: a change of a value
+     * can not be seen without walking them, which costs about as much as encoding them.
      */
     template <typename T>
-    void _marshal_into_document_(const T &var, Json::Value &dc);
+    struct FieldCache {
+        static const bool cached = Mapping_check<T>::exist;
+        static const bool elements = false;
+        static size_t Count(const void * /*var*/) { return kNoField; }
+    };
 
-    // The Overload versions of _marshal_into_document_ for STL types
-    template <typename T>
-    void _marshal_into_document_(const std::map<std::string, T> &var, Json::Value &dc);
+    template <typename T, typename A>
+    struct FieldCache<std::vector<T, A>> {
+        // a flat map holds pairs, which are not cached
+        static const bool cached = FieldCache<T>::cached;
+        static const bool elements = cached;
+        static size_t Count(const void *var) { return static_cast<const std::vector<T, A> *>(var)->size(); }
+    };
 
     template <typename T>
-    void _marshal_into_document_(const std::map<long, T> &var, Json::Value &dc);
+    struct FieldOpsFor {
+        static const FieldOps value;
+    };
 
     template <typename T>
-    void _marshal_into_document_(const std::map<int, T> &var, Json::Value &dc);
+    const FieldOps FieldOpsFor<T>::value = {&_write_field<T>, &_read_field<T>, &_pack_field<T>, &_unpack_field<T>,
+                                            &FieldCache<T>::Count, &_write_element<T>, FieldCache<T>::cached,
+                                            FieldCache<T>::elements};
 
-    template <typename T>
-    void _marshal_into_document_(const std::vector<T> &var, Json::Value &dc);
+    /**
+     * Stack of collected members. Every object being encoded owns the frame [begin, Size()),
+     * nested objects push their frames on top of it and pop them when done.
+     */
+    class FieldSink {
+    public:
+        template <typename T>
+        void Add(T &var, const char *key, size_t key_length) {
+            // keys are copied, SetJsonMapping may build them from temporaries
+            FieldRef ref = {keys_.size(), key_length, fields_.size(), &var, &FieldOpsFor<T>::value, kNoField};
+            keys_.append(key, key_length);
+            fields_.push_back(ref);
+        }
+
+        /**
+         * Run obj's SetJsonMapping in collect mode, pushing its members as a new frame
+         */
+        template <bool Exact, typename T>
+        void Collect(const T &obj) {
+            _map_with_context<Exact>(obj, AutoJsonMethod::Collect, this, nullptr);
+        }
+
+        size_t Size() const { return fields_.size(); }
+        FieldRef &At(size_t i) { return fields_[i]; }
+        const char *Key(const FieldRef &ref) const { return keys_.data() + ref.key_offset; }
+
+        /**
+         * Pop the frames above 'begin'
+         */
+        void Resize(size_t begin) {
+            if (begin < fields_.size()) {
+                keys_.resize(fields_[begin].key_offset);
+                fields_.resize(begin);
+            }
+        }
+
+        /**
+         * Sort the frame [begin, Size()) by key in the same order as Json::Value object members
+         */
+        void Sort(size_t begin) {
+            auto less = [this](const FieldRef &a, const FieldRef &b) {
+                int cmp = KeyCompare(Key(a), a.key_length, Key(b), b.key_length);
+                return cmp != 0 ? cmp < 0 : a.seq < b.seq;
+            };
+            if (!std::is_sorted(fields_.begin() + begin, fields_.end(), less)) {
+                std::sort(fields_.begin() + begin, fields_.end(), less);
+            }
+        }
+
+        static int KeyCompare(const char *a, size_t a_len, const char *b, size_t b_len) {
+            int cmp = std::memcmp(a, b, std::min(a_len, b_len));
+            if (cmp != 0) {
+                return cmp;
+            }
+            return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+        }
+
+    private:
+        std::vector<FieldRef> fields_;
+        std::string keys_;
+    };
 
     /**
-     * @brief Check if the template type T is a custom data structure for serializing
+     * Format a finite number with the fewest significant digits that read back to the same value,
+     * laid out as "%.17g" does: fixed notation for decimal exponents in [-4, 17), scientific
+     * otherwise, and ".0" appended to an integral value
+     * @param buf[out] At least 40 bytes
+     * @return Length of the text in buf
      */
-    template <typename T, typename std::enable_if<_autojson::MarshalHelper_check<T>::exist,int>::type = 0>
-    inline bool _unmarshal_for_spl_(T &obj, const Json::Value &dc) {
-        obj.Clear();
-        obj.SetMethod(AutoJsonMethod::Unmarshal);
-        if (!dc.empty() && dc.isObject()) {
-            obj.SetDocument(dc);
-            obj.SetJsonMapping();
+    template <typename F>
+    inline size_t FormatShortest(char *buf, F var) {
+        // shortest significant digits and the decimal exponent of the first one
+        char digits[24];
+        size_t count = 0;
+        int exponent = 0;
+        bool negative = std::signbit(var);
+        char tmp[40];
+#ifdef AUTO_JSON_HAS_TO_CHARS
+        char *end = std::to_chars(tmp, tmp + sizeof(tmp) - 1, var, std::chars_format::scientific).ptr;
+        *end = '\0';
+#else
+        // any decimal with at most digits10 digits round-trips to a normal number, so the first
+        // precision reading back to var is the shortest one. Subnormals have fewer digits.
+        const char *end = tmp;
+        bool subnormal = var != 0 && std::fabs(var) < std::numeric_limits<F>::min();
+        for (int precision = subnormal ? 1 : std::numeric_limits<F>::digits10; ; ++precision) {
+            end = tmp + std::snprintf(tmp, sizeof(tmp), "%.*e", precision - 1, static_cast<double>(var));
+            if (precision >= std::numeric_limits<F>::max_digits10 || static_cast<F>(std::strtod(tmp, nullptr)) == var) {
+                break;
+            }
+        }
+#endif
+        const char *p = tmp + (negative ? 1 : 0);
+        for (; p < end && *p != 'e'; ++p) {
+            if (*p >= '0' && *p <= '9') {
+                digits[count++] = *p;
+            }
+        }
+        exponent = std::atoi(p + 1);
+        while (count > 1 && digits[count - 1] == '0') {
+            --count;
+        }
+
+        char *out = buf;
+        if (negative) {
+            *out++ = '-';
+        }
+        if (exponent < -4 || exponent >= 17) {
+            *out++ = digits[0];
+            if (count > 1) {
+                *out++ = '.';
+                std::memcpy(out, digits + 1, count - 1);
+                out += count - 1;
+            }
+            out += std::snprintf(out, 8, "e%c%02d", exponent < 0 ? '-' : '+', exponent < 0 ? -exponent : exponent);
+        } else if (exponent < 0) {
+            *out++ = '0';
+            *out++ = '.';
+            for (int i = -1; i > exponent; --i) {
+                *out++ = '0';
+            }
+            std::memcpy(out, digits, count);
+            out += count;
         } else {
-            return false;
+            size_t integral = static_cast<size_t>(exponent) + 1;
+            for (size_t i = 0; i < integral; ++i) {
+                *out++ = i < count ? digits[i] : '0';
+            }
+            *out++ = '.';
+            if (count > integral) {
+                std::memcpy(out, digits + integral, count - integral);
+                out += count - integral;
+            } else {
+                *out++ = '0';
+            }
         }
-        return true;
+        return static_cast<size_t>(out - buf);
     }
 
     /**
-     * @brief Check if the template type T is not a custom data structure for deserializing
+     * The double a float member is stored as in a document: the one nearest to the float's shortest
+     * decimal, so that the document prints it with the float's digits
      */
-    template <typename T, typename std::enable_if<!_autojson::MarshalHelper_check<T>::exist,int>::type = 0>
-    inline bool _unmarshal_for_spl_(T &obj, const Json::Value &dc) {
-        this->_unmarshal_into_obj_(obj, dc);
-        return true;
+    inline double FloatToDouble(float var) {
+#ifdef AUTO_JSON_LEGACY_NUMBERS
+        return var;
+#else
+        if (var != var || var > std::numeric_limits<float>::max() || var < -std::numeric_limits<float>::max()) {
+            return var;
+        }
+        char buf[40];
+        buf[FormatShortest(buf, var)] = '\0';
+        return std::strtod(buf, nullptr);
+#endif
     }
 
-    // Deserialize core function for basic data types
-    void _unmarshal_into_obj_(int &var, const Json::Value &dc);
-    void _unmarshal_into_obj_(long &var, const Json::Value &dc);
-    void _unmarshal_into_obj_(bool &var, const Json::Value &dc);
-    void _unmarshal_into_obj_(float &var, const Json::Value &dc);
-    void _unmarshal_into_obj_(double &var, const Json::Value &dc);
-    void _unmarshal_into_obj_(std::string &var, const Json::Value &dc);
-
-    // The Overload versions of _unmarshal_into_obj_ for STL types
-    // If deserialization fails, its key should not exist in var
-    template <typename T>
-    void _unmarshal_into_obj_(std::map<std::string, T> &var, const Json::Value &dc);
+    /**
+     * Scanners for the bytes that end a plain run of a JSON string: the writer stops at '"', '\\',
+     * control and non-ASCII bytes, which it escapes, the parser stops at '"' and '\\'. Each returns
+     * the first such byte in [p, end), or end.
+     */
+    struct StringScan {
+        typedef const char *(*Scanner)(const char *p, const char *end);
 
-    template <typename T>
-    void _unmarshal_into_obj_(std::map<long, T> &var, const Json::Value &dc);
+        static const char *EscapeScalar(const char *p, const char *end) {
+            while (p < end) {
+                unsigned char ch = static_cast<unsigned char>(*p);
+                if (ch < 0x20 || ch >= 0x80 || ch == '"' || ch == '\\') {
+                    break;
+                }
+                ++p;
+            }
+            return p;
+        }
 
-    template <typename T>
-    void _unmarshal_into_obj_(std::map<int, T> &var, const Json::Value &dc);
+        static const char *QuoteScalar(const char *p, const char *end) {
+            while (p < end && *p != '"' && *p != '\\') {
+                ++p;
+            }
+            return p;
+        }
 
-    template <typename T>
-    void _unmarshal_into_obj_(std::vector<T> &var, const Json::Value &dc);
+#ifdef AUTO_JSON_HAS_SSE2
+        static const char *EscapeSse2(const char *p, const char *end) {
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            const __m128i space = _mm_set1_epi8(0x20);
+            for (; end - p >= 16; p += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                // a signed compare catches both control (< 0x20) and non-ASCII (negative) bytes
+                __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                               _mm_cmplt_epi8(v, space));
+                int mask = _mm_movemask_epi8(special);
+                if (mask != 0) {
+                    return p + __builtin_ctz(static_cast<unsigned>(mask));
+                }
+            }
+            return EscapeScalar(p, end);
+        }
 
-private:
-    Json::Value document_;
-};
+        static const char *QuoteSse2(const char *p, const char *end) {
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            for (; end - p >= 16; p += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+                if (mask != 0) {
+                    return p + __builtin_ctz(static_cast<unsigned>(mask));
+                }
+            }
+            return QuoteScalar(p, end);
+        }
 
-template <typename T>
-inline void AutoJsonHelper::_marshal_into_document(T &var, const std::string &json_key) {
-    _marshal_for_spl_(var, this->document_[json_key]);
-}
+        __attribute__((target("avx2"))) static const char *EscapeAvx2(const char *p, const char *end) {
+            const __m256i quote = _mm256_set1_epi8('"');
+            const __m256i backslash = _mm256_set1_epi8('\\');
+            const __m256i space = _mm256_set1_epi8(0x20);
+            for (; end - p >= 32; p += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                __m256i special = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                    _mm256_cmpgt_epi8(space, v));
+                unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+                if (mask != 0) {
+                    return p + __builtin_ctz(mask);
+                }
+            }
+            return EscapeSse2(p, end);
+        }
 
-template <typename T>
-inline void AutoJsonHelper::_marshal_into_document_(const T &var, Json::Value &dc) {
-    dc = var;
-}
+        __attribute__((target("avx2"))) static const char *QuoteAvx2(const char *p, const char *end) {
+            const __m256i quote = _mm256_set1_epi8('"');
+            const __m256i backslash = _mm256_set1_epi8('\\');
+            for (; end - p >= 32; p += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash))));
+                if (mask != 0) {
+                    return p + __builtin_ctz(mask);
+                }
+            }
+            return QuoteSse2(p, end);
+        }
+#endif
 
-template <>
-inline void AutoJsonHelper::_marshal_into_document_<long>(const long &var, Json::Value &dc) {
-    dc = Json::Int64(var);
-}
+        Scanner escape;
+        Scanner quote;
 
-template<typename T>
-inline void AutoJsonHelper::_marshal_into_document_(const std::map<std::string, T> &var, Json::Value &dc) {
-    for (const auto &it_var : var) {
-        _marshal_for_spl_(const_cast<T&>(it_var.second), dc[it_var.first]);
-    }
-}
+        /**
+         * The widest scanners the CPU supports, selected once
+         */
+        static const StringScan &Get() {
+#ifdef AUTO_JSON_HAS_SSE2
+            static const StringScan scan = __builtin_cpu_supports("avx2") ? StringScan{&EscapeAvx2, &QuoteAvx2}
+                                                                         : StringScan{&EscapeSse2, &QuoteSse2};
+#else
+            static const StringScan scan = {&EscapeScalar, &QuoteScalar};
+#endif
+            return scan;
+        }
 
-template<typename T>
-inline void AutoJsonHelper::_marshal_into_document_(const std::map<long, T> &var, Json::Value &dc) {
-    for (const auto &it_var : var) {
-        _marshal_for_spl_(const_cast<T&>(it_var.second), dc[std::to_string(it_var.first)]);
-    }
-}
+        // short runs are not worth the indirect call
+        static const char *Escape(const char *p, const char *end) {
+            return end - p < 16 ? EscapeScalar(p, end) : Get().escape(p, end);
+        }
 
-template<typename T>
-inline void AutoJsonHelper::_marshal_into_document_(const std::map<int, T> &var, Json::Value &dc) {
-    for (const auto &it_var : var) {
-        _marshal_for_spl_(const_cast<T&>(it_var.second), dc[std::to_string(it_var.first)]);
-    }
-}
+        static const char *Quote(const char *p, const char *end) {
+            return end - p < 16 ? QuoteScalar(p, end) : Get().quote(p, end);
+        }
+    };
 
-template<typename T>
-inline void AutoJsonHelper::_marshal_into_document_(const std::vector<T> &var, Json::Value &dc) {
-    for (int i = 0; i < var.size(); ++i) {
-        _marshal_for_spl_(const_cast<T&>(var[i]), dc[i]);
+    /**
+     * Format an integer in decimal without going through a std::string
+     * @param buf[out] At least 24 bytes
+     * @return Length of the text in buf
+     */
+    inline size_t FormatInteger(char *buf, long long var) {
+        char tmp[24];
+        char *end = tmp + sizeof(tmp);
+        char *p = end;
+        unsigned long long uvar = var < 0 ? 0ULL - static_cast<unsigned long long>(var)
+                                          : static_cast<unsigned long long>(var);
+        do {
+            *--p = static_cast<char>('0' + uvar % 10);
+            uvar /= 10;
+        } while (uvar != 0);
+        if (var < 0) {
+            *--p = '-';
+        }
+        size_t length = static_cast<size_t>(end - p);
+        std::memcpy(buf, p, length);
+        return length;
     }
-}
 
-template <typename T>
-inline void AutoJsonHelper::_unmarshal_into_obj(T &var, const std::string &json_key) {
-    if (this->document_.isMember(json_key)) {
-        _unmarshal_for_spl_(var, this->document_[json_key]);
+    /**
+     * Parse an integer map key the way atol does, without copying it into a NUL-terminated string:
+     * leading spaces and a sign are accepted, parsing stops at the first non-digit, out of range
+     * values saturate and a key that is not a number is 0
+     */
+    inline long ParseIntegerKey(const char *key, size_t length) {
+        const char *p = key;
+        const char *end = key + length;
+        while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) {
+            ++p;
+        }
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            ++p;
+        }
+        unsigned long limit = negative ? static_cast<unsigned long>(std::numeric_limits<long>::max()) + 1
+                                       : static_cast<unsigned long>(std::numeric_limits<long>::max());
+        unsigned long value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            unsigned long digit = static_cast<unsigned long>(*p - '0');
+            value = value > (limit - digit) / 10 ? limit : value * 10 + digit;
+        }
+        if (!negative) {
+            return static_cast<long>(value);
+        }
+        return value == limit ? std::numeric_limits<long>::min() : -static_cast<long>(value);
     }
-}
 
-inline void AutoJsonHelper::_unmarshal_into_obj_(int &var, const Json::Value &dc) {
-    if (dc.isIntegral()) {
-        var = dc.asInt();
-    }
-}
+    /**
+     * An integer map key formatted for sorting as a string
+     */
+    struct IntegerKey {
+        char buf[24];
+        size_t length;
+        const void *value;
+    };
 
-inline void AutoJsonHelper::_unmarshal_into_obj_(long &var, const Json::Value &dc) {
-    if (dc.isIntegral()) {
-        var = dc.asInt64();
-    }
-}
+    /**
+     * A string map key of a hash or flat map, sorted into document order before writing
+     */
+    struct StringKey {
+        const char *key;
+        size_t length;
+        const void *value;
+    };
 
-inline void AutoJsonHelper::_unmarshal_into_obj_(bool &var, const Json::Value &dc) {
-    if (dc.isBool()) {
-        var = dc.asBool();
-    }
-}
+    template <typename A>
+    inline void _assign_key(BasicString<A> &key, const char *data, size_t length) { key.assign(data, length); }
 
-inline void AutoJsonHelper::_unmarshal_into_obj_(float &var, const Json::Value &dc) {
-    if (dc.isDouble()) {
-        var = dc.asFloat();
-    }
-}
+    template <typename K>
+    inline void _assign_key(K &key, K value) { key = value; }
 
-inline void AutoJsonHelper::_unmarshal_into_obj_(double &var, const Json::Value &dc) {
-    if (dc.isDouble()) {
-        var = dc.asDouble();
-    }
-}
+    /**
+     * Fills a tree or hash map while decoding: values are constructed in place so that they take the
+     * map's allocator. A duplicate key replaces the earlier value, the last one wins as it does for
+     * object members.
+     *
+     * With a 'touched' stack the map is reused instead: the value of a key already present is decoded
+     * over in place, keeping its capacity, a duplicate key is decoded again over the same value, and
+     * the keys missing from the input are erased by End().
+     */
+    template <typename M>
+    class MapBuilder {
+    public:
+        typedef typename M::mapped_type Value;
+        typedef typename M::key_type Key;
 
-inline void AutoJsonHelper::_unmarshal_into_obj_(std::string &var, const Json::Value &dc) {
-    if (dc.isString()) {
-        var = dc.asString();
-    }
-}
+        explicit MapBuilder(M &var, std::vector<const void *> *touched = nullptr)
+            : var_(var), touched_(touched), touched_begin_(touched ? touched->size() : 0) {}
 
-template <typename T>
-inline void AutoJsonHelper::_unmarshal_into_obj_(std::map<std::string, T> &var, const Json::Value &dc) {
-    if (dc.isObject()) {
-        var.clear();
-        auto mems = dc.getMemberNames();
-        for (auto &mem : mems) {
-            T item;
-            if (_unmarshal_for_spl_(item, dc[mem])) {
-                var.template emplace(mem, item);
+        void Begin(size_t count) {
+            if (touched_ == nullptr) {
+                var_.clear();
             }
+            Reserve(var_, count);
         }
-    }
-}
 
-template <typename T>
-inline void AutoJsonHelper::_unmarshal_into_obj_(std::map<long, T> &var, const Json::Value &dc) {
-    if (dc.isObject()) {
-        var.clear();
-        auto mems = dc.getMemberNames();
-        for (auto &mem : mems) {
-            T item;
-            if (_unmarshal_for_spl_(item, dc[mem])) {
-                var.template emplace(atol(mem.c_str()), item);
+        /**
+         * Insert a default value under the key built from 'key', replacing the value of a duplicate key
+         * @return The value to decode into, nullptr if the key can not be stored
+         */
+        template <typename... K>
+        Value *Emplace(K &&... key) {
+            if (touched_ != nullptr) {
+                // look the key up first, emplace would allocate a node for an existing key
+                _assign_key(probe_, std::forward<K>(key)...);
+                auto it = var_.find(probe_);
+                if (it != var_.end()) {
+                    last_ = it;
+                    touched_->push_back(&it->second);
+                    return &it->second;
+                }
+            }
+            auto node = var_.emplace(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)...),
+                                     std::forward_as_tuple());
+            if (!node.second) {
+                // a fresh value, the earlier one may be partly overwritten by a failed decoding
+                typename M::iterator hint = var_.erase(node.first);
+                node.first = var_.emplace_hint(hint, std::piecewise_construct,
+                                               std::forward_as_tuple(std::forward<K>(key)...), std::forward_as_tuple());
             }
+            last_ = node.first;
+            if (touched_ != nullptr) {
+                touched_->push_back(&node.first->second);
+            }
+            return &node.first->second;
         }
-    }
-}
 
-template <typename T>
-inline void AutoJsonHelper::_unmarshal_into_obj_(std::vector<T> &var, const Json::Value &dc) {
-    if (dc.isArray()) {
-        var.clear();
+        /**
+         * Remove the value of the last Emplace, its decoding failed
+         */
+        void Drop() {
+            if (touched_ != nullptr) {
+                touched_->pop_back();
+            }
+            var_.erase(last_);
+        }
+
+        void End() {
+            if (touched_ == nullptr) {
+                return;
+            }
+            auto begin = touched_->begin() + static_cast<std::ptrdiff_t>(touched_begin_);
+            std::sort(begin, touched_->end());
+            auto end = std::unique(begin, touched_->end());
+            if (static_cast<size_t>(end - begin) < var_.size()) {
+                for (auto it = var_.begin(); it != var_.end();) {
+                    it = std::binary_search(begin, end, static_cast<const void *>(&it->second)) ? std::next(it)
+                                                                                                   : var_.erase(it);
+                }
+            }
+            touched_->resize(touched_begin_);
+        }
+
+    private:
+        template <typename T>
+        static void Reserve(T & /*var*/, size_t /*count*/) {}
+
+        template <typename K, typename T, typename H, typename E, typename A>
+        static void Reserve(HashMap<K, T, H, E, A> &var, size_t count) { var.reserve(count); }
+
+        M &var_;
+        std::vector<const void *> *touched_;
+        size_t touched_begin_;
+        typename M::iterator last_;
+        Key probe_;
+    };
+
+    /**
+     * Fills a flat map, reused element by element in order like a vector when 'touched' is given
+     */
+    template <typename K, typename T, typename A>
+    class MapBuilder<FlatMap<K, T, A>> {
+    public:
+        typedef T Value;
+
+        explicit MapBuilder(FlatMap<K, T, A> &var, std::vector<const void *> *touched = nullptr)
+            : var_(var), reuse_(touched != nullptr), size_(0) {
+            if (!reuse_) {
+                var_.clear();
+            }
+        }
+
+        void Begin(size_t count) { var_.reserve(count); }
+
+        template <typename... Key>
+        Value *Emplace(Key &&... key) {
+            if (size_ < var_.size()) {
+                _assign_key(var_[size_].first, std::forward<Key>(key)...);
+            } else {
+                var_.emplace_back(std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)...),
+                                  std::forward_as_tuple());
+            }
+            return &var_[size_++].second;
+        }
+
+        void Drop() {
+            // a reused element is decoded over again by the next key
+            if (!reuse_) {
+                var_.pop_back();
+            }
+            --size_;
+        }
+
+        /**
+         * Trim the elements left from the previous content, then sort by key: a stable sort keeps equal
+         * keys in input order, and the last of them is kept
+         */
+        void End() {
+            typedef std::pair<K, T> Item;
+            var_.erase(var_.begin() + static_cast<std::ptrdiff_t>(size_), var_.end());
+            auto less = [](const Item &a, const Item &b) { return a.first < b.first; };
+            if (!std::is_sorted(var_.begin(), var_.end(), less)) {
+                std::stable_sort(var_.begin(), var_.end(), less);
+            }
+            auto equal = [](const Item &a, const Item &b) { return a.first == b.first; };
+            auto it = std::adjacent_find(var_.begin(), var_.end(), equal);
+            if (it == var_.end()) {
+                return;
+            }
+            auto out = it;
+            for (; it != var_.end(); ++it) {
+                if (std::next(it) == var_.end() || !equal(*it, *std::next(it))) {
+                    if (out != it) {
+                        *out = std::move(*it);
+                    }
+                    ++out;
+                }
+            }
+            var_.erase(out, var_.end());
+        }
+
+    private:
+        FlatMap<K, T, A> &var_;
+        bool reuse_;
+        size_t size_;
+    };
+
+    /**
+     * Emplace the value of a decoded key, integer keys are parsed as atol does
+     */
+    template <typename K, typename B>
+    inline typename B::Value *_emplace_key(B &builder, const char *key, size_t length, std::true_type) {
+        return builder.Emplace(static_cast<K>(ParseIntegerKey(key, length)));
+    }
+
+    template <typename K, typename B>
+    inline typename B::Value *_emplace_key(B &builder, const char *key, size_t length, std::false_type) {
+        return builder.Emplace(key, length);
+    }
+
+    /**
+     * Scratch stacks of Writer and Parser. They only grow, so a Scratch reused across calls reaches
+     * a steady state where encoding and decoding allocate nothing but the results.
+     */
+    struct Scratch {
+        FieldSink sink;
+        std::vector<IntegerKey> int_keys;
+        std::vector<StringKey> str_keys;
+        std::vector<size_t> slots;
+        std::vector<const void *> touched;  //!< Values of reused maps decoded by the current call
+        std::string key;
+        std::string buffer;     //!< Staging output for destinations other than std::string
+        bool in_use = false;
+
+        /**
+         * Drop the content and keep the capacity
+         */
+        void Reset() {
+            sink.Resize(0);
+            int_keys.clear();
+            str_keys.clear();
+            slots.clear();
+            touched.clear();
+        }
+
+        /**
+         * The calling thread's default scratch
+         */
+        static Scratch &Local() {
+            static thread_local Scratch scratch;
+            return scratch;
+        }
+    };
+
+    /**
+     * Exclusive use of a Scratch for one call. A scratch already in use, by a Marshal nested in a
+     * SetJsonMapping for instance, is replaced by a temporary one.
+     */
+    class ScratchLease {
+    public:
+        explicit ScratchLease(Scratch &scratch) : scratch_(&scratch) {
+            if (scratch_->in_use) {
+                own_.reset(new Scratch);
+                scratch_ = own_.get();
+            }
+            scratch_->in_use = true;
+        }
+
+        ~ScratchLease() {
+            // an exception may have left frames behind
+            scratch_->Reset();
+            scratch_->in_use = false;
+        }
+
+        Scratch &Get() { return *scratch_; }
+
+    private:
+        Scratch *scratch_;
+        std::unique_ptr<Scratch> own_;
+    };
+
+    /**
+     * Tree of the dotted key paths selected by a field mask. Arrays and maps are transparent: the keys
+     * below them select the members of their elements and values.
+     */
+    class FieldMask {
+    public:
+        FieldMask() : nodes_(1) {}
+
+        FieldMask(std::initializer_list<std::string> paths) : nodes_(1) {
+            for (const std::string &path : paths) {
+                Add(path);
+            }
+        }
+
+        explicit FieldMask(const std::vector<std::string> &paths) : nodes_(1) {
+            for (const std::string &path : paths) {
+                Add(path);
+            }
+        }
+
+        /**
+         * Select a path of keys separated by '.', e.g. "innermsg.innermsg_name". The last key
+         * selects the whole value, and the objects on the way only the members on a path.
+         */
+        void Add(const std::string &path) {
+            size_t node = 0;
+            size_t begin = 0;
+            while (!nodes_[node].whole) {
+                size_t end = std::min(path.find('.', begin), path.size());
+                node = AddChild(node, path.substr(begin, end - begin));
+                if (end == path.size()) {
+                    nodes_[node].whole = true;
+                    nodes_[node].children.clear();
+                    break;
+                }
+                begin = end + 1;
+            }
+        }
+
+        /**
+         * Whether the member 'key' of an object at 'node' is selected
+         * @param child[out] Node of the member's value, kNoField when all of it is selected
+         */
+        bool Select(size_t node, const char *key, size_t length, size_t &child) const {
+            const std::vector<std::pair<std::string, size_t>> &children = nodes_[node].children;
+            auto less = [](const std::pair<std::string, size_t> &entry, const std::pair<const char *, size_t> &value) {
+                return FieldSink::KeyCompare(entry.first.data(), entry.first.size(), value.first, value.second) < 0;
+            };
+            auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(key, length), less);
+            if (it == children.end() || it->first.size() != length || std::memcmp(it->first.data(), key, length) != 0) {
+                return false;
+            }
+            child = nodes_[it->second].whole ? kNoField : it->second;
+            return true;
+        }
+
+    private:
+        struct Node {
+            std::vector<std::pair<std::string, size_t>> children;   //!< Key and node index, sorted by key
+            bool whole = false;
+        };
+
+        size_t AddChild(size_t node, const std::string &key) {
+            std::vector<std::pair<std::string, size_t>> &children = nodes_[node].children;
+            auto it = std::lower_bound(children.begin(), children.end(), key,
+                                       [](const std::pair<std::string, size_t> &entry, const std::string &value) {
+                                           return FieldSink::KeyCompare(entry.first.data(), entry.first.size(),
+                                                                        value.data(), value.size()) < 0;
+                                       });
+            if (it != children.end() && it->first == key) {
+                return it->second;
+            }
+            size_t child = nodes_.size();
+            children.insert(it, std::make_pair(key, child));
+            nodes_.emplace_back();
+            return child;
+        }
+
+        std::vector<Node> nodes_;
+    };
+
+    /**
+     * Streaming JSON writer. Appends the encoded object straight into the output string without
+     * building a Json::Value document, producing the same bytes as Json::FastWriter.
+     */
+    class Writer {
+    public:
+        /**
+         * @param mask[in] Members to write, all of them if nullptr
+         */
+        Writer(std::string &out, Scratch &scratch, const FieldMask *mask = nullptr)
+            : out_(out), sink_(scratch.sink), int_keys_(scratch.int_keys), str_keys_(scratch.str_keys), mask_(mask),
+              node_(mask != nullptr ? 0 : kNoField) {}
+
+        /**
+         * Encode the root object, nothing is written if it has no mapped member
+         */
+        template <typename T>
+        void WriteRoot(const T &obj) { WriteObject<false>(obj); }
+
+        /**
+         * Write a quoted object key followed by ':'
+         */
+        void WriteKey(const char *key, size_t length) {
+            WriteString(key, length);
+            out_.push_back(':');
+        }
+
+        void WriteValue(int var) { WriteInteger(static_cast<long long>(var)); }
+        void WriteValue(long var) { WriteInteger(static_cast<long long>(var)); }
+        void WriteValue(bool var) { out_.append(var ? "true" : "false"); }
+        void WriteValue(float var);
+        void WriteValue(double var);
+
+        template <typename A>
+        void WriteValue(const BasicString<A> &var) { WriteString(var.data(), var.size()); }
+
+        template <typename T, typename A>
+        void WriteValue(const std::vector<T, A> &var);
+
+        template <typename T, typename SA, typename A>
+        void WriteValue(const BasicMap<BasicString<SA>, T, A> &var);
+
+        template <typename T, typename A>
+        void WriteValue(const BasicMap<long, T, A> &var) { WriteIntegerKeyMap(var); }
+
+        template <typename T, typename A>
+        void WriteValue(const BasicMap<int, T, A> &var) { WriteIntegerKeyMap(var); }
+
+        template <typename T, typename SA, typename H, typename E, typename A>
+        void WriteValue(const HashMap<BasicString<SA>, T, H, E, A> &var) { WriteStringKeyMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        void WriteValue(const HashMap<long, T, H, E, A> &var) { WriteIntegerKeyMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        void WriteValue(const HashMap<int, T, H, E, A> &var) { WriteIntegerKeyMap(var); }
+
+        template <typename T, typename SA, typename A>
+        void WriteValue(const FlatMap<BasicString<SA>, T, A> &var) { WriteStringKeyMap(var); }
+
+        template <typename T, typename A>
+        void WriteValue(const FlatMap<long, T, A> &var) { WriteIntegerKeyMap(var); }
+
+        template <typename T, typename A>
+        void WriteValue(const FlatMap<int, T, A> &var) { WriteIntegerKeyMap(var); }
+
+        template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+        void WriteValue(const T &obj) {
+            // a nested object without members is a null document
+            if (!WriteObject(obj)) {
+                out_.append("null");
+            }
+        }
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+        /**
+         * Write a parsed document the way Json::FastWriter does
+         */
+        void WriteDocument(const Json::Value &root);
+#endif
+
+    private:
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type = 0>
+        bool WriteObject(const T &obj);
+
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type = 0>
+        bool WriteObject(const T &obj);
+
+        void WriteFields(size_t begin);
+        void WriteInteger(long long var);
+
+        template <typename F>
+        void WriteReal(F var);
+        void WriteString(const char *str, size_t length);
+
+        template <typename M>
+        void WriteIntegerKeyMap(const M &var);
+
+        template <typename M>
+        void WriteStringKeyMap(const M &var);
+
+        std::string &out_;
+        FieldSink &sink_;
+        std::vector<IntegerKey> &int_keys_;
+        std::vector<StringKey> &str_keys_;
+        const FieldMask *mask_;
+        size_t node_;   //!< Mask node of the object being written, kNoField when unmasked
+    };
+
+    template <typename T>
+    inline void _write_field(Writer &writer, const void *var) {
+        writer.WriteValue(*static_cast<const T *>(var));
+    }
+
+    template <typename V>
+    inline void _write_element_of(Writer & /*writer*/, const V & /*var*/, size_t /*index*/, std::false_type) {}
+
+    template <typename T, typename A>
+    inline void _write_element_of(Writer &writer, const std::vector<T, A> &var, size_t index, std::true_type) {
+        writer.WriteValue(var[index]);
+    }
+
+    template <typename T>
+    inline void _write_element(Writer &writer, const void *var, size_t index) {
+        _write_element_of(writer, *static_cast<const T *>(var), index,
+                          std::integral_constant<bool, FieldCache<T>::elements>());
+    }
+
+    /**
+     * Per-type table built once from AUTO_JSON_FIELDS: the member descriptors, their keys in
+     * Json::Value member order and the encoded key prefixes
+     */
+    template <typename T>
+    class FieldTable {
+    public:
+        typedef typename FieldTable_check<T>::source Source;
+        typedef decltype(Source::_auto_json_fields()) Fields;
+        static const size_t kSize = std::tuple_size<Fields>::value;
+
+        static const FieldTable &Get() {
+            static const FieldTable table;
+            return table;
+        }
+
+        /**
+         * Range [first, last) of 'order' whose key equals the given one, a single probe of the
+         * perfect hash and one key comparison
+         */
+        void Find(const char *key, size_t key_length, size_t &first, size_t &last) const {
+            first = last = 0;
+            if (kSize == 0) {
+                return;
+            }
+            const Slot &slot = slots_[KeyHash(key, key_length, seed_) & mask_];
+            size_t i = order[slot.first];
+            if (slot.first != slot.last && lengths[i] == key_length && std::memcmp(keys[i], key, key_length) == 0) {
+                first = slot.first;
+                last = slot.last;
+            }
+        }
+
+        /**
+         * Call f(field) for the i-th field through a table of thunks, one per field
+         */
+        template <typename F>
+        void Visit(size_t i, const F &f) const {
+            Thunks<F, typename MakeIndexes<kSize>::type>::At(i)(fields, f);
+        }
+
+        const Fields fields;
+        const char *keys[kSize + 1];
+        size_t lengths[kSize + 1];
+        std::string prefix[kSize + 1];  //!< "key": already escaped
+        size_t order[kSize + 1];        //!< Field indexes sorted by key, then by declaration
+        size_t write_order[kSize + 1];  //!< Same without the shadowed duplicates of a key
+        size_t write_count = 0;
+
+    private:
+        struct Slot {
+            size_t first;
+            size_t last;
+        };
+
+        template <typename F, typename Seq>
+        struct Thunks;
+
+        template <typename F, size_t... I>
+        struct Thunks<F, Indexes<I...>> {
+            typedef void (*Thunk)(const Fields &, const F &);
+
+            template <size_t J>
+            static void Call(const Fields &fields, const F &f) {
+                f(std::get<J>(fields));
+            }
+
+            static Thunk At(size_t i) {
+                // constant-initialized, the trailing entry keeps the array non-empty
+                static const Thunk thunks[kSize + 1] = {&Call<I>..., nullptr};
+                return thunks[i];
+            }
+        };
+
+        struct KeyCollector {
+            FieldTable &table;
+
+            template <typename C, typename M>
+            void operator()(size_t i, const Field<C, M> &field) {
+                table.keys[i] = field.key;
+                table.lengths[i] = field.key_length;
+                Scratch scratch;
+                Writer writer(table.prefix[i], scratch);
+                writer.WriteKey(field.key, field.key_length);
+            }
+        };
+
+        FieldTable() : fields(Source::_auto_json_fields()) {
+            KeyCollector collector{*this};
+            FieldEach<0, kSize>::Apply(fields, collector);
+            for (size_t i = 0; i < kSize; ++i) {
+                order[i] = i;
+            }
+            std::sort(order, order + kSize, [this](size_t a, size_t b) {
+                int cmp = FieldSink::KeyCompare(keys[a], lengths[a], keys[b], lengths[b]);
+                return cmp != 0 ? cmp < 0 : a < b;
+            });
+            // the same key mapped twice keeps the last declaration, like Json::Value does
+            for (size_t k = 0; k < kSize; ++k) {
+                size_t i = order[k];
+                if (k + 1 < kSize && FieldSink::KeyCompare(keys[i], lengths[i], keys[order[k + 1]],
+                                                           lengths[order[k + 1]]) == 0) {
+                    continue;
+                }
+                write_order[write_count++] = i;
+            }
+            BuildHash();
+        }
+
+        /**
+         * Search a seed and a table size for which the distinct keys never share a slot
+         */
+        void BuildHash() {
+            size_t size = 1;
+            while (size < 2 * write_count) {
+                size *= 2;
+            }
+            for (;; size *= 2) {
+                for (uint32_t seed = 0; seed < 64; ++seed) {
+                    if (TryHash(size, seed)) {
+                        return;
+                    }
+                }
+            }
+        }
+
+        bool TryHash(size_t size, uint32_t seed) {
+            std::vector<Slot> slots(size, Slot{0, 0});
+            for (size_t first = 0; first < kSize;) {
+                size_t i = order[first];
+                size_t last = first + 1;
+                while (last < kSize && FieldSink::KeyCompare(keys[order[last]], lengths[order[last]], keys[i], lengths[i]) == 0) {
+                    ++last;
+                }
+                Slot &slot = slots[KeyHash(keys[i], lengths[i], seed) & (size - 1)];
+                if (slot.first != slot.last) {
+                    return false;
+                }
+                slot = Slot{first, last};
+                first = last;
+            }
+            slots_.swap(slots);
+            mask_ = size - 1;
+            seed_ = seed;
+            return true;
+        }
+
+        std::vector<Slot> slots_;
+        size_t mask_ = 0;
+        uint32_t seed_ = 0;
+    };
+
+    /**
+     * A decoded number, Int whenever it fits a long long
+     */
+    struct Number {
+        enum Type { Int, UInt, Real } type;
+        long long int_value;
+        unsigned long long uint_value;
+        double real_value;
+
+        double ToDouble() const {
+            return type == Int ? static_cast<double>(int_value)
+                               : (type == UInt ? static_cast<double>(uint_value) : real_value);
+        }
+    };
+
+    /**
+     * Assign a decoded number to a member, values out of the member's range are ignored like any
+     * other mismatched type
+     */
+    inline void _assign_number(const Number &number, int &var) {
+        if (number.type == Number::Int) {
+            if (number.int_value >= std::numeric_limits<int>::min() &&
+                number.int_value <= std::numeric_limits<int>::max()) {
+                var = static_cast<int>(number.int_value);
+            }
+        } else if (number.type == Number::Real) {
+            double d = number.real_value;
+            if (d >= std::numeric_limits<int>::min() && d <= std::numeric_limits<int>::max() &&
+                static_cast<double>(static_cast<int>(d)) == d) {
+                var = static_cast<int>(d);
+            }
+        }
+    }
+
+    inline void _assign_number(const Number &number, long &var) {
+        if (number.type == Number::Int) {
+            var = static_cast<long>(number.int_value);
+        } else if (number.type == Number::Real) {
+            double d = number.real_value;
+            if (d >= -9223372036854775808.0 && d < 9223372036854775808.0 &&
+                static_cast<double>(static_cast<long long>(d)) == d) {
+                var = static_cast<long>(d);
+            }
+        }
+    }
+
+    inline void _assign_number(const Number &number, double &var) { var = number.ToDouble(); }
+
+    inline void _assign_number(const Number &number, float &var) { var = static_cast<float>(number.ToDouble()); }
+
+    /**
+     * Index the frame [begin, Size()) of the sink by key on top of 'slots', members sharing a key
+     * are chained through FieldRef::next in declaration order
+     * @return Mask of the frame's slot count
+     */
+    inline size_t _index_frame(FieldSink &sink, std::vector<size_t> &slots, size_t begin) {
+        size_t end = sink.Size();
+        size_t size = 1;
+        while (size < 2 * (end - begin)) {
+            size *= 2;
+        }
+        size_t slot_begin = slots.size();
+        slots.resize(slot_begin + size, kNoField);
+        size_t mask = size - 1;
+        for (size_t i = begin; i < end; ++i) {
+            FieldRef &field = sink.At(i);
+            const char *key = sink.Key(field);
+            size_t h = KeyHash(key, field.key_length, 0) & mask;
+            for (;; h = (h + 1) & mask) {
+                size_t &slot = slots[slot_begin + h];
+                if (slot == kNoField) {
+                    slot = i;
+                    break;
+                }
+                FieldRef *other = &sink.At(slot);
+                if (other->key_length == field.key_length && std::memcmp(sink.Key(*other), key, field.key_length) == 0) {
+                    while (other->next != kNoField) {
+                        other = &sink.At(other->next);
+                    }
+                    other->next = i;
+                    break;
+                }
+            }
+        }
+        return mask;
+    }
+
+    /**
+     * First member of the indexed frame mapped to the key, kNoField if there is none
+     */
+    inline size_t _find_field(FieldSink &sink, const std::vector<size_t> &slots, size_t slot_begin, size_t mask,
+                              const char *key, size_t key_length) {
+        for (size_t h = KeyHash(key, key_length, 0) & mask;; h = (h + 1) & mask) {
+            size_t i = slots[slot_begin + h];
+            if (i == kNoField) {
+                return kNoField;
+            }
+            const FieldRef &field = sink.At(i);
+            if (field.key_length == key_length && std::memcmp(sink.Key(field), key, key_length) == 0) {
+                return i;
+            }
+        }
+    }
+
+    /**
+     * Pull parser. Reads the JSON text token by token and assigns the values straight into the
+     * mapped members, members of unknown keys are skipped without being materialized.
+     * Accepts the same input as Json::Reader, comments included.
+     *
+     * ReadValue returns false when the value can not be converted into a custom data structure,
+     * the same way _unmarshal_for_spl_ does. Syntax errors stop the parsing, see Failed().
+     */
+    class Parser {
+    public:
+        /**
+         * @param reuse[in] Decode over the existing content of vectors and maps instead of rebuilding
+         *                  them, see AutoJson::UnmarshalReuse
+         * @param mask[in] Members to read, all of them if nullptr
+         */
+        Parser(const char *begin, const char *end, Scratch &scratch, bool reuse = false, const FieldMask *mask = nullptr)
+            : cur_(begin), end_(end), reuse_(reuse), mask_(mask), node_(mask != nullptr ? 0 : kNoField),
+              sink_(scratch.sink), slots_(scratch.slots), key_(scratch.key), touched_(scratch.touched) {}
+
+        /**
+         * Decode the root object, obj is left untouched when the root is not a non-empty object.
+         * Members are assigned while parsing, those before a syntax error keep their new values.
+         * @return false if the root is not an object or has a syntax error
+         */
+        template <typename T>
+        bool ReadRoot(T &obj) {
+            SkipSpace();
+            if (Peek() != '{') {
+                return false;
+            }
+            if (!ConsumeEmptyObject()) {
+                ReadObject<false>(obj);
+            }
+            return !failed_;
+        }
+
+        bool Failed() const { return failed_; }
+
+        /**
+         * Text range of a JSON value
+         */
+        struct Span {
+            const char *begin;
+            const char *end;
+        };
+
+        /**
+         * Split the root array into the text of its elements without decoding them, the elements
+         * before a syntax error are kept
+         * @return false if the root is not an array or has a syntax error
+         */
+        bool SplitArray(std::vector<Span> &elements);
+
+        /**
+         * Member of an object, its key is kept in a separate buffer
+         */
+        struct Member {
+            size_t key_offset;
+            size_t key_length;
+            Span value;
+        };
+
+        /**
+         * Split the root object into its keys and the text of its values without decoding them,
+         * the members before a syntax error are kept
+         * @param keys[in,out] Decoded keys are appended to it
+         * @return false if the root is not an object or has a syntax error
+         */
+        bool SplitObject(std::vector<Member> &members, std::string &keys);
+
+        bool ReadValue(int &var);
+        bool ReadValue(long &var);
+        bool ReadValue(bool &var);
+        bool ReadValue(float &var);
+        bool ReadValue(double &var);
+
+        template <typename A>
+        bool ReadValue(BasicString<A> &var);
+
+        template <typename T, typename A>
+        bool ReadValue(std::vector<T, A> &var);
+
+        template <typename T, typename SA, typename A>
+        bool ReadValue(BasicMap<BasicString<SA>, T, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename A>
+        bool ReadValue(BasicMap<long, T, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename A>
+        bool ReadValue(BasicMap<int, T, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename SA, typename H, typename E, typename A>
+        bool ReadValue(HashMap<BasicString<SA>, T, H, E, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        bool ReadValue(HashMap<long, T, H, E, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        bool ReadValue(HashMap<int, T, H, E, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename SA, typename A>
+        bool ReadValue(FlatMap<BasicString<SA>, T, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename A>
+        bool ReadValue(FlatMap<long, T, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename A>
+        bool ReadValue(FlatMap<int, T, A> &var) { return ReadMap(var); }
+
+        template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+        bool ReadValue(T &obj);
+
+    private:
+        static const int kMaxDepth = 1000;  //!< Same nesting limit as Json::Reader
+
+        char Peek() const { return cur_ < end_ ? *cur_ : '\0'; }
+        bool Fail() { failed_ = true; cur_ = end_; return false; }
+
+        void SkipSpace();
+        bool SkipValue();
+        bool SkipString();
+        bool ConsumeEmptyObject();
+        bool ConsumeLiteral(const char *literal, size_t length);
+        bool ReadNumber(Number &number);
+        bool ReadNumberValue(Number &number);
+
+        template <typename S>
+        bool ReadStringInto(S &out);
+
+        bool ReadKey(const char *&key, size_t &key_length);
+        bool NextMember(bool &done);
+
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type = 0>
+        void ReadObject(T &obj);
+
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type = 0>
+        void ReadObject(T &obj);
+
+        template <typename M>
+        bool ReadMap(M &var);
+
+        template <typename T, typename A>
+        bool ReadElement(std::vector<T, A> &var, size_t index);
+
+        template <typename A>
+        bool ReadElement(std::vector<bool, A> &var, size_t index);
+
+
+        const char *cur_;
+        const char *end_;
+        bool failed_ = false;
+        bool reuse_;
+        const FieldMask *mask_;
+        size_t node_;   //!< Mask node of the object being read, kNoField when unmasked
+        int depth_ = 0;
+        FieldSink &sink_;
+        std::vector<size_t> &slots_;    //!< Open-addressing key index of every frame being read
+        std::string &key_;  //!< Decoded key when it contains escapes
+        std::vector<const void *> &touched_;
+    };
+
+    template <typename T>
+    inline bool _read_field(Parser &parser, void *var) {
+        return parser.ReadValue(*static_cast<T *>(var));
+    }
+
+    /**
+     * MessagePack encoder driven by the same mappings as Writer. An object is a map keyed by its
+     * mapped names in the order of the JSON text, and every value is encoded where JSON has the
+     * equivalent: empty containers and objects without members are nil, the keys of integer-keyed
+     * maps stay integers.
+     */
+    class Packer {
+    public:
+        Packer(std::string &out, Scratch &scratch) : out_(out), sink_(scratch.sink) {}
+
+        /**
+         * Encode the root object, nothing is written if it has no mapped member
+         */
+        template <typename T>
+        void PackRoot(const T &obj) { PackObject<false>(obj); }
+
+        void PackValue(int var) { PackInteger(var); }
+        void PackValue(long var) { PackInteger(var); }
+        void PackValue(bool var) { out_.push_back(static_cast<char>(var ? 0xc3 : 0xc2)); }
+        void PackValue(float var);
+        void PackValue(double var);
+
+        template <typename A>
+        void PackValue(const BasicString<A> &var) { PackString(var.data(), var.size()); }
+
+        template <typename T, typename A>
+        void PackValue(const std::vector<T, A> &var);
+
+        template <typename T, typename SA, typename A>
+        void PackValue(const BasicMap<BasicString<SA>, T, A> &var) { PackMap(var); }
+
+        template <typename T, typename A>
+        void PackValue(const BasicMap<long, T, A> &var) { PackMap(var); }
+
+        template <typename T, typename A>
+        void PackValue(const BasicMap<int, T, A> &var) { PackMap(var); }
+
+        template <typename T, typename SA, typename H, typename E, typename A>
+        void PackValue(const HashMap<BasicString<SA>, T, H, E, A> &var) { PackMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        void PackValue(const HashMap<long, T, H, E, A> &var) { PackMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        void PackValue(const HashMap<int, T, H, E, A> &var) { PackMap(var); }
+
+        template <typename T, typename SA, typename A>
+        void PackValue(const FlatMap<BasicString<SA>, T, A> &var) { PackMap(var); }
+
+        template <typename T, typename A>
+        void PackValue(const FlatMap<long, T, A> &var) { PackMap(var); }
+
+        template <typename T, typename A>
+        void PackValue(const FlatMap<int, T, A> &var) { PackMap(var); }
+
+        template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+        void PackValue(const T &obj) {
+            // a nested object without members is nil, like the null of the JSON text
+            if (!PackObject(obj)) {
+                PackNil();
+            }
+        }
+
+    private:
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type = 0>
+        bool PackObject(const T &obj);
+
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type = 0>
+        bool PackObject(const T &obj);
+
+        template <typename M>
+        void PackMap(const M &var);
+
+        void PackKey(long long key) { PackInteger(key); }
+
+        template <typename A>
+        void PackKey(const BasicString<A> &key) { PackString(key.data(), key.size()); }
+
+        void PackNil() { out_.push_back(static_cast<char>(0xc0)); }
+        void PackInteger(long long var);
+        void PackString(const char *str, size_t length);
+
+        /**
+         * Header of an array (0x90, 0xdc) or a map (0x80, 0xde) of 'count' items
+         */
+        void PackHeader(size_t count, unsigned char fix, unsigned char code16);
+        void PutBig(uint64_t value, size_t bytes);
+
+        std::string &out_;
+        FieldSink &sink_;
+    };
+
+    /**
+     * MessagePack decoder, the counterpart of Packer. A value of another type than the member's is
+     * skipped and leaves the member as it was, the same way Parser treats JSON values. Integer map
+     * keys are also accepted as strings, parsed as atol does. A truncated input stops the decoding,
+     * see Failed().
+     */
+    class Unpacker {
+    public:
+        Unpacker(const char *begin, const char *end, Scratch &scratch)
+            : cur_(begin), end_(end), sink_(scratch.sink), slots_(scratch.slots) {}
+
+        /**
+         * Decode the root object, obj is left untouched when the root is not a non-empty map
+         * @return false if the root is not a map or is truncated
+         */
+        template <typename T>
+        bool UnpackRoot(T &obj) {
+            size_t count = 0;
+            if (!ReadHeader(0x80, 0xde, count)) {
+                return false;
+            }
+            if (count != 0) {
+                UnpackObject<false>(obj, count);
+            }
+            return !failed_;
+        }
+
+        bool Failed() const { return failed_; }
+
+        bool UnpackValue(int &var);
+        bool UnpackValue(long &var);
+        bool UnpackValue(bool &var);
+        bool UnpackValue(float &var);
+        bool UnpackValue(double &var);
+
+        template <typename A>
+        bool UnpackValue(BasicString<A> &var);
+
+        template <typename T, typename A>
+        bool UnpackValue(std::vector<T, A> &var);
+
+        template <typename T, typename SA, typename A>
+        bool UnpackValue(BasicMap<BasicString<SA>, T, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename A>
+        bool UnpackValue(BasicMap<long, T, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename A>
+        bool UnpackValue(BasicMap<int, T, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename SA, typename H, typename E, typename A>
+        bool UnpackValue(HashMap<BasicString<SA>, T, H, E, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        bool UnpackValue(HashMap<long, T, H, E, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename H, typename E, typename A>
+        bool UnpackValue(HashMap<int, T, H, E, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename SA, typename A>
+        bool UnpackValue(FlatMap<BasicString<SA>, T, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename A>
+        bool UnpackValue(FlatMap<long, T, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename A>
+        bool UnpackValue(FlatMap<int, T, A> &var) { return UnpackMap(var); }
+
+        template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+        bool UnpackValue(T &obj);
+
+    private:
+        static const int kMaxDepth = 1000;  //!< Same nesting limit as Parser
+
+        unsigned char Peek() const { return cur_ < end_ ? static_cast<unsigned char>(*cur_) : 0xc1; }
+        bool Fail() { failed_ = true; cur_ = end_; return false; }
+
+        bool ReadBig(size_t bytes, uint64_t &value);
+
+        /**
+         * Read the header of an array (0x90, 0xdc) or a map (0x80, 0xde)
+         * @return false, consuming nothing, if the value is of another type
+         */
+        bool ReadHeader(unsigned char fix, unsigned char code16, size_t &count);
+
+        /**
+         * Read a string, false consuming nothing if the value is of another type
+         */
+        bool ReadString(const char *&str, size_t &length);
+
+        /**
+         * Read the value if it is a number, other values are skipped and false is returned
+         */
+        bool ReadNumber(Number &number);
+        bool SkipValue();
+
+        template <typename K, typename B>
+        typename B::Value *ReadMapKey(B &builder);
+
+        template <typename K, typename B>
+        typename B::Value *ReadNumberKey(B &builder, std::true_type);
+
+        template <typename K, typename B>
+        typename B::Value *ReadNumberKey(B & /*builder*/, std::false_type) {
+            SkipValue();
+            return nullptr;
+        }
+
+        template <typename T, typename A>
+        bool UnpackElement(std::vector<T, A> &var);
+
+        template <typename A>
+        bool UnpackElement(std::vector<bool, A> &var);
+
+        template <typename M>
+        bool UnpackMap(M &var);
+
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type = 0>
+        void UnpackObject(T &obj, size_t count);
+
+        template <bool Exact = true, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type = 0>
+        void UnpackObject(T &obj, size_t count);
+
+        const char *cur_;
+        const char *end_;
+        bool failed_ = false;
+        int depth_ = 0;
+        FieldSink &sink_;
+        std::vector<size_t> &slots_;
+    };
+
+    template <typename T>
+    inline void _pack_field(Packer &packer, const void *var) {
+        packer.PackValue(*static_cast<const T *>(var));
+    }
+
+    template <typename T>
+    inline bool _unpack_field(Unpacker &unpacker, void *var) {
+        return unpacker.UnpackValue(*static_cast<T *>(var));
+    }
+
+    /**
+     * Encoded size of T learned from previous calls, so that an output buffer grows about once per
+     * call instead of doubling its way up. Follows the largest recent size and decays slowly.
+     */
+    template <typename T>
+    struct SizeHint {
+        static std::atomic<size_t> &Value() {
+            static std::atomic<size_t> value(0);
+            return value;
+        }
+
+        /**
+         * Make room for one more encoded T at the end of 'out', growing geometrically
+         */
+        static void Reserve(std::string &out) {
+            size_t need = out.size() + Value().load(std::memory_order_relaxed);
+            if (need > out.capacity()) {
+                out.reserve(std::max(need, out.capacity() * 2));
+            }
+        }
+
+        static void Learn(size_t size) {
+            size_t hint = Value().load(std::memory_order_relaxed);
+            Value().store(size >= hint ? size : hint - (hint - size) / 8, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * Append the encoded root object to 'out' with an already leased scratch. Nothing is appended if
+     * the object has no mapped member, and an exception leaves 'out' as it was.
+     * @param out[in,out] Output buffer, its content is kept
+     * @param obj[in] Object needs to be serialized
+     * @param scratch[in,out] Scratch stacks leased by the caller
+     * @param mask[in] Members to write, all of them if nullptr
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline void _append_root(std::string &out, const T &obj, Scratch &scratch, const FieldMask *mask = nullptr) {
+        size_t begin = out.size();
+        SizeHint<T>::Reserve(out);
+        try {
+            Writer writer(out, scratch, mask);
+            writer.WriteRoot(obj);
+        } catch (...) {
+            out.resize(begin);
+            throw;
+        }
+        // a projection says nothing about the size of the whole object
+        if (mask == nullptr) {
+            SizeHint<T>::Learn(out.size() - begin);
+        }
+    }
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline void _append_root(std::string & /*out*/, const T & /*obj*/, Scratch & /*scratch*/,
+                             const FieldMask * /*mask*/ = nullptr) {}
+
+    /**
+     * Serialize object at the end of 'out' without clearing it
+     * @param out[in,out] Output buffer, its content and capacity are kept
+     * @param obj[in] Object needs to be serialized
+     * @param scratch[in,out] Reusable scratch stacks
+     * @param mask[in] Members to write, all of them if nullptr
+     */
+    template <typename T>
+    inline void _marshal_append(std::string &out, const T &obj, Scratch &scratch, const FieldMask *mask = nullptr) {
+        ScratchLease lease(scratch);
+        _append_root(out, obj, lease.Get(), mask);
+    }
+
+    /**
+     * Serialize object into the staging buffer of a leased scratch, for destinations the writer
+     * cannot append to directly
+     * @return The staging buffer, valid while the lease is held
+     */
+    template <typename T>
+    inline const std::string &_marshal_staged(const T &obj, Scratch &scratch) {
+        scratch.buffer.clear();
+        _append_root(scratch.buffer, obj, scratch);
+        return scratch.buffer;
+    }
+
+    /**
+     * Generic serialize method, the result is an empty string for a class without mapping
+     * @tparam T Derived class of AutoJsonHelper or type declared with AUTO_JSON_FIELDS
+     * @param json_string[in,out] JSON result after serializing, its capacity is reused
+     * @param obj[in] Object needs to be serialized
+     * @param scratch[in,out] Reusable scratch stacks
+     * @param mask[in] Members to write, all of them if nullptr
+     */
+    template <typename T>
+    inline void _marshal(std::string &json_string, const T &obj, Scratch &scratch, const FieldMask *mask = nullptr) {
+        json_string.clear();
+        _marshal_append(json_string, obj, scratch, mask);
+    }
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+    /**
+     * Serialize into a document, nested objects are built in place inside 'root'
+     * @tparam T Derived class of AutoJsonHelper or type declared with AUTO_JSON_FIELDS
+     * @param root[in,out] JSON document result, null if the object has no mapped member
+     * @param obj[in] Object needs to be serialized
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline void _marshal(Json::Value &root, const T &obj);
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline void _marshal(Json::Value &root, const T &obj) {
+        root = Json::Value();
+    }
+#endif
+
+
+    /**
+     * Generic deserialize method for class that has 'SetJsonMapping' function(return an empty string on failure)
+     * @tparam T Derived class of AutoJsonHelper
+     * @param begin[in] Start of the Json needs to be deserialized
+     * @param end[in] End of the Json
+     * @param obj[in,out] Object result after deserializing
+     * @param scratch[in,out] Reusable scratch stacks
+     * @param reuse[in] Decode over the existing content of containers, see AutoJson::UnmarshalReuse
+     * @param mask[in] Members to read, all of them if nullptr
+     * @return false if the root is not an object or has a syntax error
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline bool _unmarshal(const char *begin, const char *end, T &obj, Scratch &scratch, bool reuse = false,
+                           const FieldMask *mask = nullptr) {
+        // Members are assigned while parsing, on a syntax error the members before it keep their new values
+        ScratchLease lease(scratch);
+        Parser parser(begin, end, lease.Get(), reuse, mask);
+        return parser.ReadRoot(obj);
+    }
+
+    /**
+     * Generic deserialize method for class that DOESNT have 'SetJsonMapping' function(do nothing)
+     * @return false, nothing can be decoded
+     */
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline bool _unmarshal(const char * /*begin*/, const char * /*end*/, T & /*obj*/, Scratch & /*scratch*/,
+                           bool /*reuse*/ = false, const FieldMask * /*mask*/ = nullptr) {
+        return false;
+    }
+
+    /**
+     * Deserialize the text staged in scratch.buffer, the caller holds the scratch's lease
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline bool _unmarshal_staged(T &obj, Scratch &scratch) {
+        const std::string &json = scratch.buffer;
+        Parser parser(json.data(), json.data() + json.size(), scratch);
+        return parser.ReadRoot(obj);
+    }
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline bool _unmarshal_staged(T & /*obj*/, Scratch & /*scratch*/) {
+        return false;
+    }
+
+    /**
+     * Serialize object to MessagePack, the result is empty for a class without mapping
+     * @param out[in,out] MessagePack result, its capacity is reused
+     * @param obj[in] Object needs to be serialized
+     * @param scratch[in,out] Reusable scratch stacks
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline void _pack(std::string &out, const T &obj, Scratch &scratch) {
+        out.clear();
+        ScratchLease lease(scratch);
+        Packer packer(out, lease.Get());
+        packer.PackRoot(obj);
+    }
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline void _pack(std::string &out, const T & /*obj*/, Scratch & /*scratch*/) {
+        out.clear();
+    }
+
+    /**
+     * Deserialize MessagePack to object, members are assigned while decoding
+     * @return false if the root is not a map or is truncated
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline bool _unpack(const char *begin, const char *end, T &obj, Scratch &scratch) {
+        ScratchLease lease(scratch);
+        Unpacker unpacker(begin, end, lease.Get());
+        return unpacker.UnpackRoot(obj);
+    }
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline bool _unpack(const char * /*begin*/, const char * /*end*/, T & /*obj*/, Scratch & /*scratch*/) {
+        return false;
+    }
+
+    template <typename T>
+    inline bool _unmarshal(const std::string &json_string, T &obj, Scratch &scratch) {
+        return _unmarshal(json_string.data(), json_string.data() + json_string.size(), obj, scratch);
+    }
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+    /**
+     * Deserialize a parsed document, nested objects are read from 'root' in place
+     * @tparam T Derived class of AutoJsonHelper or type declared with AUTO_JSON_FIELDS
+     * @param root[in] The document needs to be deserialized
+     * @param obj[in,out] Object result after deserializing
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type = 0>
+    inline void _unmarshal(const Json::Value &root, T &obj);
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline void _unmarshal(const Json::Value &root, T &obj) {}
+#endif
+
+
+    /**
+     * Number of chunks 'count' items are split into for 'parallelism' threads
+     * @param parallelism Number of threads, 0 for std::thread::hardware_concurrency()
+     */
+    inline size_t _chunk_count(size_t count, size_t parallelism) {
+        if (parallelism == 0) {
+            parallelism = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+        return std::max<size_t>(std::min(parallelism, count), 1);
+    }
+
+    /**
+     * Run f(chunk, begin, end) for one of errors.size() contiguous ranges of 'count' items, its
+     * exception is kept in errors[chunk]
+     */
+    template <typename F>
+    inline void _run_chunk(const F &f, size_t count, size_t chunk, std::vector<std::exception_ptr> &errors) {
+        size_t chunks = errors.size();
+        try {
+            f(chunk, count * chunk / chunks, count * (chunk + 1) / chunks);
+        } catch (...) {
+            errors[chunk] = std::current_exception();
+        }
+    }
+
+    inline void _rethrow_first(const std::vector<std::exception_ptr> &errors) {
+        for (auto &error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    /**
+     * Run f(chunk, begin, end) over 'count' items split into 'chunks' contiguous ranges, one thread
+     * each, the calling thread runs the first one. An exception of any chunk is rethrown after all
+     * threads joined.
+     */
+    template <typename F>
+    inline void _parallel_for(size_t count, size_t chunks, const F &f) {
+        std::vector<std::exception_ptr> errors(chunks);
+        std::vector<std::thread> threads;
+        threads.reserve(chunks - 1);
+        for (size_t chunk = 1; chunk < chunks; ++chunk) {
+            threads.emplace_back([&, chunk] { _run_chunk(f, count, chunk, errors); });
+        }
+        _run_chunk(f, count, 0, errors);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        _rethrow_first(errors);
+    }
+
+    /**
+     * Runs the chunks of a batch on threads started for the call, when no AutoJson::ThreadPool is given.
+     * Same interface as AutoJson::ThreadPool.
+     */
+    struct ThreadRunner {
+        size_t parallelism;
+
+        size_t Chunks(size_t count) const { return _chunk_count(count, parallelism); }
+
+        template <typename F>
+        void ParallelFor(size_t count, size_t chunks, const F &f) {
+            _parallel_for(count, chunks, f);
+        }
+    };
+
+    /**
+     * Batch functions behind AutoJson::MarshalMany/UnmarshalMany, the chunks run on 'runner'
+     */
+    template <typename T, typename Runner>
+    inline void _marshal_many(std::string &json_array, const std::vector<T> &objs, Runner &runner) {
+        size_t chunks = runner.Chunks(objs.size());
+        // the first chunk is written straight into the result, the others are appended after it
+        std::vector<std::string> parts(chunks - 1);
+        json_array.assign(1, '[');
+        runner.ParallelFor(objs.size(), chunks, [&](size_t chunk, size_t begin, size_t end) {
+            std::string &out = chunk == 0 ? json_array : parts[chunk - 1];
+            ScratchLease lease(Scratch::Local());
+            Writer writer(out, lease.Get());
+            for (size_t i = begin; i < end; ++i) {
+                if (i != 0) {
+                    out.push_back(',');
+                }
+                writer.WriteValue(objs[i]);
+            }
+        });
+        for (const auto &part : parts) {
+            json_array.append(part);
+        }
+        json_array.push_back(']');
+    }
+
+    template <typename T, typename Runner>
+    inline void _marshal_many(std::vector<std::string> &json_strings, const std::vector<T> &objs, Runner &runner) {
+        json_strings.resize(objs.size());
+        runner.ParallelFor(objs.size(), runner.Chunks(objs.size()), [&](size_t /*chunk*/, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                _marshal(json_strings[i], objs[i], Scratch::Local());
+            }
+        });
+    }
+
+    template <typename T, typename Runner>
+    inline bool _unmarshal_many(const char *data, size_t length, std::vector<T> &objs, Runner &runner) {
+        std::vector<Parser::Span> elements;
+        bool split = false;
+        {
+            ScratchLease lease(Scratch::Local());
+            Parser parser(data, data + length, lease.Get());
+            split = parser.SplitArray(elements);
+        }
+        objs.clear();
+        objs.resize(elements.size());
+        // one flag per element, each written by the thread decoding it
+        std::vector<char> ok(elements.size());
+        runner.ParallelFor(elements.size(), runner.Chunks(elements.size()),
+                           [&](size_t /*chunk*/, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                ok[i] = _unmarshal(elements[i].begin, elements[i].end, objs[i], Scratch::Local());
+            }
+        });
+        return split && std::find(ok.begin(), ok.end(), 0) == ok.end();
+    }
+
+    template <typename T, typename Runner>
+    inline bool _unmarshal_many(const std::vector<std::string> &json_strings, std::vector<T> &objs, Runner &runner) {
+        objs.resize(json_strings.size());
+        std::vector<char> ok(json_strings.size());
+        runner.ParallelFor(json_strings.size(), runner.Chunks(json_strings.size()),
+                           [&](size_t /*chunk*/, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                ok[i] = _unmarshal(json_strings[i], objs[i], Scratch::Local());
+            }
+        });
+        return std::find(ok.begin(), ok.end(), 0) == ok.end();
+    }
+
+    /**
+     * Keys of the members of T by the member's offset, built once per type. The members of a
+     * default-constructed prototype are collected, their addresses identify the member pointers.
+     */
+    template <typename T>
+    class ViewKeys {
+    public:
+        struct Entry {
+            size_t offset;
+            const char *key;
+            size_t key_length;
+        };
+
+        static const ViewKeys &Get() {
+            static const ViewKeys keys;
+            return keys;
+        }
+
+        template <typename M, typename C>
+        size_t Offset(M C::*member) const {
+            return Offset(&(prototype_.*member));
+        }
+
+        /**
+         * Range [first, last) of the entries of the member at 'offset', several keys may map it
+         */
+        void Find(size_t offset, size_t &first, size_t &last) const {
+            auto less = [](const Entry &entry, size_t value) { return entry.offset < value; };
+            first = std::lower_bound(entries_.begin(), entries_.end(), offset, less) - entries_.begin();
+            last = first;
+            while (last < entries_.size() && entries_[last].offset == offset) {
+                ++last;
+            }
+        }
+
+        const Entry &At(size_t i) const { return entries_[i]; }
+
+    private:
+        struct OffsetCollector {
+            ViewKeys &keys;
+            const FieldTable<T> &table;
+
+            template <typename C, typename M>
+            void operator()(size_t i, const Field<C, M> &field) {
+                keys.entries_.push_back(Entry{keys.Offset(&(keys.prototype_.*field.member)), table.keys[i],
+                                              table.lengths[i]});
+            }
+        };
+
+        ViewKeys() {
+            Collect(prototype_);
+            std::stable_sort(entries_.begin(), entries_.end(),
+                             [](const Entry &a, const Entry &b) { return a.offset < b.offset; });
+        }
+
+        template <typename U, typename std::enable_if<Mapping_check<U>::helper,int>::type = 0>
+        void Collect(const U &obj) {
+            sink_.Collect<true>(obj);
+            for (size_t i = 0; i < sink_.Size(); ++i) {
+                const FieldRef &field = sink_.At(i);
+                entries_.push_back(Entry{Offset(field.var), sink_.Key(field), field.key_length});
+            }
+        }
+
+        template <typename U, typename std::enable_if<Mapping_check<U>::table,int>::type = 0>
+        void Collect(const U & /*obj*/) {
+            OffsetCollector collector{*this, FieldTable<T>::Get()};
+            FieldEach<0, FieldTable<T>::kSize>::Apply(FieldTable<T>::Get().fields, collector);
+        }
+
+        size_t Offset(const void *var) const {
+            return static_cast<const char *>(var) - reinterpret_cast<const char *>(&prototype_);
+        }
+
+        T prototype_;
+        FieldSink sink_;    //!< Owns the collected keys
+        std::vector<Entry> entries_;
+    };
+
+    template <typename T>
+    struct FieldAdder {
+        FieldSink &sink;
+        const T &obj;
+
+        template <typename C, typename M>
+        void operator()(size_t /*i*/, const Field<C, M> &field) {
+            sink.Add(const_cast<M &>(obj.*field.member), field.key, field.key_length);
+        }
+    };
+
+    /**
+     * Push the members of the root object as a frame of the sink, whichever way its mapping is declared
+     */
+    template <typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type = 0>
+    inline void _collect_fields(FieldSink &sink, const T &obj) {
+        sink.Collect<false>(obj);
+    }
+
+    template <typename T, typename std::enable_if<Mapping_check<T>::table,int>::type = 0>
+    inline void _collect_fields(FieldSink &sink, const T &obj) {
+        FieldAdder<T> adder{sink, obj};
+        FieldEach<0, FieldTable<T>::kSize>::Apply(FieldTable<T>::Get().fields, adder);
+    }
+
+    template <typename T, typename std::enable_if<!Mapping_check<T>::exist,int>::type = 0>
+    inline void _collect_fields(FieldSink & /*sink*/, const T & /*obj*/) {}
+}
+
+namespace AutoJson {
+    /**
+     * Set of dotted key paths, such as "innermsg.innermsg_name" or "array_innermsg.innermsg_id",
+     * selecting the members Marshal and Unmarshal visit. Paths go through arrays and maps into their
+     * elements. An empty mask selects nothing.
+     */
+    typedef _autojson::FieldMask FieldMask;
+
+    /**
+     * Serialize object to JSON string
+     * @param json_string[in,out] JSON result
+     * @param obj[in] Object needs to be serialized
+     */
+    template <typename T>
+    inline void Marshal(std::string &json_string, const T &obj) {
+        _autojson::_marshal(json_string, obj, _autojson::Scratch::Local());
+    }
+
+    /**
+     * Serialize only the members selected by the mask, other members are never encoded. An object
+     * on a selected path is written with its selected members only, "{}" if none of them is mapped.
+     * @param json_string[in,out] JSON result
+     * @param obj[in] Object needs to be serialized
+     * @param mask[in] Selected members
+     */
+    template <typename T>
+    inline void Marshal(std::string &json_string, const T &obj, const FieldMask &mask) {
+        _autojson::_marshal(json_string, obj, _autojson::Scratch::Local(), &mask);
+    }
+
+    /**
+     * Serialize object at the end of a buffer without clearing it, to concatenate several objects
+     * into one body. Nothing is appended for an object without mapped members.
+     * @param out[in,out] Output buffer, its content and capacity are kept
+     * @param obj[in] Object needs to be serialized
+     */
+    template <typename T>
+    inline void MarshalAppend(std::string &out, const T &obj) {
+        _autojson::_marshal_append(out, obj, _autojson::Scratch::Local());
+    }
+
+    template <typename T>
+    inline void MarshalAppend(std::vector<char> &out, const T &obj) {
+        _autojson::ScratchLease lease(_autojson::Scratch::Local());
+        const std::string &json = _autojson::_marshal_staged(obj, lease.Get());
+        out.insert(out.end(), json.begin(), json.end());
+    }
+
+    /**
+     * Serialize object into a fixed-capacity buffer, no NUL is appended
+     * @param data[out] Output buffer
+     * @param capacity[in] Size of the buffer
+     * @param obj[in] Object needs to be serialized
+     * @return Length of the JSON text. If it exceeds 'capacity' nothing is written, retry with a
+     *         buffer of at least that size.
+     */
+    template <typename T>
+    inline size_t MarshalTo(char *data, size_t capacity, const T &obj) {
+        _autojson::ScratchLease lease(_autojson::Scratch::Local());
+        const std::string &json = _autojson::_marshal_staged(obj, lease.Get());
+        if (json.size() <= capacity && !json.empty()) {
+            std::memcpy(data, json.data(), json.size());
+        }
+        return json.size();
+    }
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+    /**
+     * Serialize object to JSON document
+     * @param root[in,out] JSON document result
+     * @param obj[in] Object needs to be serialized
+     */
+    template <typename T>
+    inline void Marshal(Json::Value &root, const T &obj) {
+        _autojson::_marshal(root, obj);
+    }
+#endif
+
+    /**
+     * Deserialized JSON string to object. Members are assigned while parsing: on a syntax error the
+     * members decoded before it keep their new values, the others keep their content.
+     * @param json_string[in] JSON string needs to be deserialized
+     * @param obj[in,out] Object result
+     * @return false if the root is not an object or the text has a syntax error
+     */
+    template <typename T>
+    inline bool Unmarshal(const std::string &json_string, const T &obj) {
+        return _autojson::_unmarshal(json_string, const_cast<T&>(obj), _autojson::Scratch::Local());
+    }
+
+    /**
+     * Deserialized JSON text from any buffer (socket, shared memory, mapped file) without copying it
+     * @param data[in] JSON text needs to be deserialized, need not be NUL-terminated
+     * @param length[in] Length of the text
+     * @param obj[in,out] Object result
+     * @return false if the root is not an object or the text has a syntax error
+     */
+    template <typename T>
+    inline bool Unmarshal(const char *data, size_t length, const T &obj) {
+        return _autojson::_unmarshal(data, data + length, const_cast<T&>(obj), _autojson::Scratch::Local());
+    }
+
+    /**
+     * Deserialized a NUL-terminated JSON string to object
+     * @param json_string[in] JSON string needs to be deserialized
+     * @param obj[in,out] Object result
+     */
+    template <typename T>
+    inline bool Unmarshal(const char *json_string, const T &obj) {
+        return Unmarshal(json_string, std::strlen(json_string), obj);
+    }
+
+#if __cplusplus >= 201703L
+    /**
+     * Deserialized JSON text viewed by a string_view without copying it
+     * @param json_string[in] JSON text needs to be deserialized
+     * @param obj[in,out] Object result
+     */
+    template <typename T>
+    inline bool Unmarshal(std::string_view json_string, const T &obj) {
+        return Unmarshal(json_string.data(), json_string.size(), obj);
+    }
+#endif
+
+    /**
+     * Deserialized JSON text into an object reused across calls. Vectors, flat maps, strings and nested
+     * objects are decoded over their existing content and keep their capacity, only the tail is
+     * trimmed or grown, and map keys already present are decoded in place. A member or element whose
+     * input is missing or of another type keeps its previous content, as the members of the root
+     * object always do.
+     * @param data[in] JSON text needs to be deserialized, need not be NUL-terminated
+     * @param length[in] Length of the text
+     * @param obj[in,out] Object result, decoded over
+     * @return false if the root is not an object or the text has a syntax error
+     */
+    template <typename T>
+    inline bool UnmarshalReuse(const char *data, size_t length, T &obj) {
+        return _autojson::_unmarshal(data, data + length, obj, _autojson::Scratch::Local(), true);
+    }
+
+    template <typename T>
+    inline bool UnmarshalReuse(const std::string &json_string, T &obj) {
+        return UnmarshalReuse(json_string.data(), json_string.size(), obj);
+    }
+
+    /**
+     * Deserialized only the members selected by the mask, the values of other members are skipped
+     * without being decoded and the members keep their previous content
+     * @param data[in] JSON text needs to be deserialized, need not be NUL-terminated
+     * @param length[in] Length of the text
+     * @param obj[in,out] Object result
+     * @param mask[in] Selected members
+     * @return false if the root is not an object or the text has a syntax error
+     */
+    template <typename T>
+    inline bool Unmarshal(const char *data, size_t length, const T &obj, const FieldMask &mask) {
+        return _autojson::_unmarshal(data, data + length, const_cast<T&>(obj), _autojson::Scratch::Local(), false,
+                                     &mask);
+    }
+
+    template <typename T>
+    inline bool Unmarshal(const std::string &json_string, const T &obj, const FieldMask &mask) {
+        return Unmarshal(json_string.data(), json_string.size(), obj, mask);
+    }
+
+    /**
+     * Serialize object to MessagePack with the mapping and keys Marshal uses, a compact binary form
+     * of the same content: objects are maps, empty containers and objects without members are nil
+     * where JSON has null, and the keys of integer-keyed maps stay integers. Nothing is written for
+     * an object without mapped members.
+     * @param out[in,out] MessagePack result, its capacity is reused
+     * @param obj[in] Object needs to be serialized
+     */
+    template <typename T>
+    inline void MarshalMsgPack(std::string &out, const T &obj) {
+        _autojson::_pack(out, obj, _autojson::Scratch::Local());
+    }
+
+    /**
+     * Deserialized MessagePack to object, with the same rules as Unmarshal: values of another type
+     * are ignored and missing members keep their content
+     * @param data[in] MessagePack bytes
+     * @param length[in] Number of bytes
+     * @param obj[in,out] Object result
+     * @return false if the root is not a map or the input is truncated
+     */
+    template <typename T>
+    inline bool UnmarshalMsgPack(const char *data, size_t length, const T &obj) {
+        return _autojson::_unpack(data, data + length, const_cast<T&>(obj), _autojson::Scratch::Local());
+    }
+
+    template <typename T>
+    inline bool UnmarshalMsgPack(const std::string &data, const T &obj) {
+        return UnmarshalMsgPack(data.data(), data.size(), obj);
+    }
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+    /**
+     * Deserialized an already parsed JSON document to object without copying it
+     * @param root[in] JSON document needs to be deserialized
+     * @param obj[in,out] Object result
+     */
+    template <typename T>
+    inline void Unmarshal(const Json::Value &root, const T &obj) {
+        _autojson::_unmarshal(root, const_cast<T&>(obj));
+    }
+
+    /**
+     * jsoncpp as a document backend. Marshal/Unmarshal on a Json::Value build and read the document
+     * directly and are faster than going through this backend, it is the reference for writing others.
+     */
+    struct JsoncppBackend {
+        typedef Json::Value Document;
+
+        static bool Parse(const char *data, size_t length, Document &doc) {
+            static thread_local std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+            return reader->parse(data, data + length, &doc, nullptr);
+        }
+
+        static void Write(const Document &doc, std::string &json) {
+            // WriteDocument only appends to the output, the stacks stay empty
+            _autojson::Scratch scratch;
+            _autojson::Writer writer(json, scratch);
+            writer.WriteDocument(doc);
+        }
+    };
+#endif
+
+    /**
+     * Serialize object into the document type of a JSON library plugged in as a backend. The mapped
+     * types do not change: the in-tree engine encodes the object and the backend parses the text.
+     * A backend is a struct with
+     *     typedef ... Document;   // default-constructible and assignable
+     *     static bool Parse(const char *data, size_t length, Document &doc);
+     *     static void Write(const Document &doc, std::string &json);    // appends to json
+     * @tparam Backend The backend, e.g. AutoJson::JsoncppBackend
+     * @param doc[in,out] Document result, a default-constructed one if the object has no mapped member
+     * @param obj[in] Object needs to be serialized
+     * @return false if the backend rejected the text
+     */
+    template <typename Backend, typename T>
+    inline bool MarshalDocument(typename Backend::Document &doc, const T &obj) {
+        _autojson::ScratchLease lease(_autojson::Scratch::Local());
+        const std::string &json = _autojson::_marshal_staged(obj, lease.Get());
+        if (json.empty()) {
+            doc = typename Backend::Document();
+            return true;
+        }
+        return Backend::Parse(json.data(), json.size(), doc);
+    }
+
+    /**
+     * Deserialized a document of a backend's JSON library to object: the backend writes it as text
+     * which the in-tree engine decodes, see MarshalDocument
+     * @tparam Backend The backend, e.g. AutoJson::JsoncppBackend
+     * @param doc[in] Document needs to be deserialized
+     * @param obj[in,out] Object result
+     * @return false if the document is not an object or the backend wrote invalid text
+     */
+    template <typename Backend, typename T>
+    inline bool UnmarshalDocument(const typename Backend::Document &doc, const T &obj) {
+        _autojson::ScratchLease lease(_autojson::Scratch::Local());
+        _autojson::Scratch &scratch = lease.Get();
+        scratch.buffer.clear();
+        Backend::Write(doc, scratch.buffer);
+        return _autojson::_unmarshal_staged(const_cast<T&>(obj), scratch);
+    }
+
+    /**
+     * Worker threads for the batch functions, e.g. MarshalMany(json_array, objs, pool), so a job calling
+     * them repeatedly does not start and join threads on every call. The calling thread runs a chunk
+     * of its batch too and takes queued chunks while it waits, batches of several threads may share
+     * one pool. Owned by the caller, the header keeps no global state.
+     */
+    class ThreadPool {
+    public:
+        /**
+         * @param parallelism[in] Number of threads running a batch, the caller included, 0 for one per core
+         */
+        explicit ThreadPool(size_t parallelism = 0);
+
+        /**
+         * Joins the workers, no batch may be running
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t Parallelism() const { return workers_.size() + 1; }
+
+        /**
+         * Number of chunks 'count' items are split into
+         */
+        size_t Chunks(size_t count) const { return _autojson::_chunk_count(count, Parallelism()); }
+
+        /**
+         * Run f(chunk, begin, end) over 'count' items split into 'chunks' contiguous ranges, the
+         * calling thread runs the first one. An exception of any chunk is rethrown after all finished.
+         */
+        template <typename F>
+        void ParallelFor(size_t count, size_t chunks, const F &f);
+
+    private:
+        /**
+         * Run the oldest queued task with the lock released
+         * @return false if the queue is empty
+         */
+        bool RunOne(std::unique_lock<std::mutex> &lock);
+
+        std::vector<std::thread> workers_;
+        std::deque<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable queued_;    //!< A task was queued or the pool stops
+        std::condition_variable finished_;  //!< A task finished
+        bool stop_ = false;
+    };
+
+    inline ThreadPool::ThreadPool(size_t parallelism) {
+        // one chunk per thread for an unbounded batch, the caller runs one of them
+        size_t workers = _autojson::_chunk_count(std::numeric_limits<size_t>::max(), parallelism) - 1;
+        workers_.reserve(workers);
+        for (size_t i = 0; i < workers; ++i) {
+            workers_.emplace_back([this] {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!stop_) {
+                    if (!RunOne(lock)) {
+                        queued_.wait(lock);
+                    }
+                }
+            });
+        }
+    }
+
+    inline ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        queued_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    inline bool ThreadPool::RunOne(std::unique_lock<std::mutex> &lock) {
+        if (tasks_.empty()) {
+            return false;
+        }
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+        return true;
+    }
+
+    template <typename F>
+    inline void ThreadPool::ParallelFor(size_t count, size_t chunks, const F &f) {
+        std::vector<std::exception_ptr> errors(chunks);
+        size_t pending = chunks - 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t chunk = 1; chunk < chunks; ++chunk) {
+                tasks_.emplace_back([&, chunk] {
+                    _autojson::_run_chunk(f, count, chunk, errors);
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --pending;
+                    finished_.notify_all();
+                });
+            }
+        }
+        queued_.notify_all();
+        _autojson::_run_chunk(f, count, 0, errors);
+        {
+            // help with the queue rather than only wait, so a busy pool cannot stall this batch
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (pending != 0) {
+                if (!RunOne(lock)) {
+                    finished_.wait(lock);
+                }
+            }
+        }
+        _autojson::_rethrow_first(errors);
+    }
+
+    /**
+     * Serialize objects into one JSON array, each element encoded the same way as a vector element
+     * @param json_array[in,out] JSON array result
+     * @param objs[in] Objects need to be serialized
+     * @param parallelism[in] Number of threads encoding contiguous chunks, 0 for one per core. The
+     *                        threads are started for this call, pass a ThreadPool to reuse them.
+     */
+    template <typename T>
+    inline void MarshalMany(std::string &json_array, const std::vector<T> &objs, size_t parallelism = 1) {
+        _autojson::ThreadRunner runner{parallelism};
+        _autojson::_marshal_many(json_array, objs, runner);
+    }
+
+    template <typename T>
+    inline void MarshalMany(std::string &json_array, const std::vector<T> &objs, ThreadPool &pool) {
+        _autojson::_marshal_many(json_array, objs, pool);
+    }
+
+    /**
+     * Serialize every object into its own JSON string, same as calling Marshal on each
+     * @param json_strings[in,out] JSON results, resized to the number of objects and their capacity reused
+     * @param objs[in] Objects need to be serialized
+     * @param parallelism[in] Number of threads encoding contiguous chunks, 0 for one per core
+     */
+    template <typename T>
+    inline void MarshalMany(std::vector<std::string> &json_strings, const std::vector<T> &objs, size_t parallelism = 1) {
+        _autojson::ThreadRunner runner{parallelism};
+        _autojson::_marshal_many(json_strings, objs, runner);
+    }
+
+    template <typename T>
+    inline void MarshalMany(std::vector<std::string> &json_strings, const std::vector<T> &objs, ThreadPool &pool) {
+        _autojson::_marshal_many(json_strings, objs, pool);
+    }
+
+    /**
+     * Deserialize a JSON array into objects. The array is split first, then the elements are decoded
+     * independently, each the same way as Unmarshal: an element which is not a valid object keeps the
+     * members decoded before its error. On a syntax error of the array only the elements before it
+     * are kept.
+     * @param data[in] JSON array needs to be deserialized, need not be NUL-terminated
+     * @param length[in] Length of the text
+     * @param objs[in,out] Objects result, one per element
+     * @param parallelism[in] Number of threads decoding contiguous chunks, 0 for one per core
+     * @return false if the root is not an array, has a syntax error or an element failed to decode
+     */
+    template <typename T>
+    inline bool UnmarshalMany(const char *data, size_t length, std::vector<T> &objs, size_t parallelism = 1) {
+        _autojson::ThreadRunner runner{parallelism};
+        return _autojson::_unmarshal_many(data, length, objs, runner);
+    }
+
+    template <typename T>
+    inline bool UnmarshalMany(const char *data, size_t length, std::vector<T> &objs, ThreadPool &pool) {
+        return _autojson::_unmarshal_many(data, length, objs, pool);
+    }
+
+    template <typename T>
+    inline bool UnmarshalMany(const std::string &json_array, std::vector<T> &objs, size_t parallelism = 1) {
+        return UnmarshalMany(json_array.data(), json_array.size(), objs, parallelism);
+    }
+
+    template <typename T>
+    inline bool UnmarshalMany(const std::string &json_array, std::vector<T> &objs, ThreadPool &pool) {
+        return UnmarshalMany(json_array.data(), json_array.size(), objs, pool);
+    }
+
+    /**
+     * Deserialize every JSON string into its own object, same as calling Unmarshal on each
+     * @param json_strings[in] JSON strings need to be deserialized
+     * @param objs[in,out] Objects result, resized to the number of strings
+     * @param parallelism[in] Number of threads decoding contiguous chunks, 0 for one per core
+     * @return false if any string is not a JSON object or has a syntax error
+     */
+    template <typename T>
+    inline bool UnmarshalMany(const std::vector<std::string> &json_strings, std::vector<T> &objs, size_t parallelism = 1) {
+        _autojson::ThreadRunner runner{parallelism};
+        return _autojson::_unmarshal_many(json_strings, objs, runner);
+    }
+
+    template <typename T>
+    inline bool UnmarshalMany(const std::vector<std::string> &json_strings, std::vector<T> &objs, ThreadPool &pool) {
+        return _autojson::_unmarshal_many(json_strings, objs, pool);
+    }
+
+    /**
+     * Keeps the scratch stacks and an output buffer across calls, so a worker encoding and decoding
+     * a stream of messages reaches a steady state without allocation. Not thread-safe, use one Codec
+     * per thread. AutoJson::Marshal/Unmarshal already reuse a per-thread scratch, a Codec adds the
+     * output buffer and keeps its capacity under the caller's control.
+     */
+    class Codec {
+    public:
+        /**
+         * Serialize object to JSON string
+         * @param json_string[in,out] JSON result, its capacity is reused
+         * @param obj[in] Object needs to be serialized
+         */
+        template <typename T>
+        void Marshal(std::string &json_string, const T &obj) {
+            _autojson::_marshal(json_string, obj, scratch_);
+        }
+
+        /**
+         * Serialize object into the codec's buffer
+         * @param obj[in] Object needs to be serialized
+         * @return JSON result, valid until the next call on this codec
+         */
+        template <typename T>
+        const std::string &Marshal(const T &obj) {
+            _autojson::_marshal(buffer_, obj, scratch_);
+            return buffer_;
+        }
+
+        /**
+         * Serialize object at the end of a buffer without clearing it
+         * @param out[in,out] Output buffer, its content and capacity are kept
+         * @param obj[in] Object needs to be serialized
+         */
+        template <typename T>
+        void MarshalAppend(std::string &out, const T &obj) {
+            _autojson::_marshal_append(out, obj, scratch_);
+        }
+
+        /**
+         * Deserialized JSON string to object
+         * @param json_string[in] JSON string needs to be deserialized
+         * @param obj[in,out] Object result
+         * @return false if the root is not an object or the text has a syntax error
+         */
+        template <typename T>
+        bool Unmarshal(const std::string &json_string, T &obj) {
+            return _autojson::_unmarshal(json_string, obj, scratch_);
+        }
+
+        template <typename T>
+        bool Unmarshal(const char *data, size_t length, T &obj) {
+            return _autojson::_unmarshal(data, data + length, obj, scratch_);
+        }
+
+        /**
+         * Deserialized JSON string over the existing content of obj, see AutoJson::UnmarshalReuse
+         */
+        template <typename T>
+        bool UnmarshalReuse(const std::string &json_string, T &obj) {
+            return _autojson::_unmarshal(json_string.data(), json_string.data() + json_string.size(), obj, scratch_,
+                                         true);
+        }
+
+        /**
+         * Release the memory kept between calls
+         */
+        void Shrink() {
+            scratch_ = _autojson::Scratch();
+            std::string().swap(buffer_);
+        }
+
+    private:
+        _autojson::Scratch scratch_;
+        std::string buffer_;
+    };
+
+    /**
+     * Lazy accessor of a JSON object mapped by T. The first access splits the root object into its
+     * members without decoding them, then every Get decodes only the value of the requested member.
+     * Nested objects and arrays that are never asked for are skipped. The members are named by
+     * member pointers and found through the keys T's mapping declares.
+     *
+     * The text must outlive the view. Not thread-safe, use one view per thread.
+     * @tparam T Derived class of AutoJsonHelper or type declared with AUTO_JSON_FIELDS, default-constructible
+     */
+    template <typename T>
+    class View {
+    public:
+        View() : View(nullptr, 0) {}
+
+        /**
+         * @param data[in] JSON text, need not be NUL-terminated
+         * @param length[in] Length of the text
+         */
+        View(const char *data, size_t length) : begin_(data), end_(data + length) {}
+
+        explicit View(const std::string &json_string) : View(json_string.data(), json_string.size()) {}
+
+#if __cplusplus >= 201703L
+        explicit View(std::string_view json_string) : View(json_string.data(), json_string.size()) {}
+#endif
+
+        /**
+         * @return false if the root is not an object or has a syntax error, the members before
+         *         the error are still available
+         */
+        bool Valid() const {
+            Split();
+            return valid_;
+        }
+
+        /**
+         * @return true if the text has a key mapped to the member
+         */
+        template <typename M, typename C>
+        bool Has(M C::*member) const {
+            return Find(member) != nullptr;
+        }
+
+        /**
+         * Decode the member's value, the same way Unmarshal would
+         * @param member[in] Member pointer of T or of a base of T
+         * @param var[in,out] Value result, a scalar of another type is ignored as Unmarshal does
+         * @return false if the member is missing, or its value can not be converted into a container
+         *         or an object
+         */
+        template <typename M, typename C>
+        bool Get(M C::*member, M &var) const {
+            const _autojson::Parser::Member *found = Find(member);
+            if (found == nullptr) {
+                return false;
+            }
+            _autojson::ScratchLease lease(_autojson::Scratch::Local());
+            _autojson::Parser parser(found->value.begin, found->value.end, lease.Get());
+            return parser.ReadValue(var) && !parser.Failed();
+        }
+
+        /**
+         * Decode the member's value, a value-initialized one if it is missing or can not be converted
+         */
+        template <typename M, typename C>
+        M Get(M C::*member) const {
+            M var{};
+            Get(member, var);
+            return var;
+        }
+
+        /**
+         * View of a nested object without decoding it, an invalid view if the member is missing
+         */
+        template <typename M, typename C>
+        View<M> Sub(M C::*member) const {
+            const _autojson::Parser::Member *found = Find(member);
+            if (found == nullptr) {
+                return View<M>();
+            }
+            return View<M>(found->value.begin, static_cast<size_t>(found->value.end - found->value.begin));
+        }
+
+    private:
+        void Split() const {
+            if (split_) {
+                return;
+            }
+            split_ = true;
+            if (begin_ == end_) {
+                return;
+            }
+            _autojson::ScratchLease lease(_autojson::Scratch::Local());
+            _autojson::Parser parser(begin_, end_, lease.Get());
+            valid_ = parser.SplitObject(members_, keys_);
+        }
+
+        template <typename M, typename C>
+        const _autojson::Parser::Member *Find(M C::*member) const {
+            static_assert(std::is_base_of<C, T>::value, "the member must belong to T or to a base of T");
+            Split();
+            const _autojson::ViewKeys<T> &keys = _autojson::ViewKeys<T>::Get();
+            size_t first = 0;
+            size_t last = 0;
+            keys.Find(keys.Offset(member), first, last);
+            // the last occurrence of a key wins, as in Unmarshal
+            for (size_t i = members_.size(); i-- > 0 && first != last;) {
+                const _autojson::Parser::Member &candidate = members_[i];
+                for (size_t k = first; k < last; ++k) {
+                    const typename _autojson::ViewKeys<T>::Entry &entry = keys.At(k);
+                    if (entry.key_length == candidate.key_length &&
+                        std::memcmp(entry.key, keys_.data() + candidate.key_offset, entry.key_length) == 0) {
+                        return &candidate;
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+        const char *begin_;
+        const char *end_;
+        mutable bool split_ = false;
+        mutable bool valid_ = false;
+        mutable std::vector<_autojson::Parser::Member> members_;
+        mutable std::string keys_;
+    };
+
+    /**
+     * Incremental re-Marshal of one object. The encoded bytes of its object members and vectors of
+     * objects are kept between calls, and only the members touched since the previous call are
+     * encoded again. Scalars, strings, maps and vectors of those are encoded on every call, seeing
+     * whether they changed costs about as much. A vector of objects is cached element by element,
+     * keyed by index: touching an element re-encodes it alone, elements appended at the end are
+     * encoded without touching anything, and a vector which shrank is re-encoded whole.
+     *
+     * The cache can not see a change inside a nested object, nor an insertion before the end of a
+     * vector of objects or an erase combined with an append in the same call: those must be declared
+     * with Touch, else their stale bytes are spliced. Unless NDEBUG is defined, every spliced member
+     * is encoded again and compared, so a missed Touch fails an assert in tests.
+     * Bound to the object's address. Not thread-safe.
+     * @tparam T Derived class of AutoJsonHelper or type declared with AUTO_JSON_FIELDS
+     */
+    template <typename T>
+    class FragmentCache {
+    public:
+        /**
+         * @param obj[in] Object to serialize, must outlive the cache
+         */
+        explicit FragmentCache(const T &obj) : obj_(obj) {}
+
+        /**
+         * Declare that a member of the object changed, e.g. Touch(obj.innermsg). For a nested
+         * member, touch the member of the object that contains it.
+         */
+        template <typename M>
+        void Touch(const M &member) {
+            dirty_.push_back(&member);
+        }
+
+        /**
+         * Declare that one element of a vector member changed
+         */
+        template <typename M, typename A>
+        void Touch(const std::vector<M, A> &member, size_t index) {
+            dirty_elements_.push_back(std::make_pair(static_cast<const void *>(&member), index));
+        }
+
+        /**
+         * Drop every cached byte, after assigning the whole object for instance
+         */
+        void TouchAll() {
+            fragments_.clear();
+            dirty_.clear();
+            dirty_elements_.clear();
+        }
+
+        /**
+         * Serialize the object, splicing the cached bytes of the untouched members
+         * @param json_string[in,out] JSON result, its capacity is reused
+         */
+        void Marshal(std::string &json_string);
+
+        /**
+         * Serialize the object into the cache's buffer
+         * @return JSON result, valid until the next call on this cache
+         */
+        const std::string &Marshal() {
+            Marshal(buffer_);
+            return buffer_;
+        }
+
+    private:
+        struct Fragment {
+            const void *var = nullptr;
+            size_t count = 0;                   //!< Size of the container when it was encoded
+            std::string bytes;                  //!< Encoded value, empty until encoded
+            std::vector<std::string> elements;  //!< Encoded elements of a vector cached by element
+        };
+
+        /**
+         * Move the member's fragment out of the previous call's, an empty one if it has none
+         */
+        void Take(const void *var, Fragment &fragment) {
+            for (size_t k = 0; k < fragments_.size(); ++k) {
+                // members usually come in the same order as in the previous call
+                Fragment &candidate = fragments_[(next_.size() + k) % fragments_.size()];
+                if (candidate.var == var) {
+                    fragment = std::move(candidate);
+                    candidate.var = nullptr;
+                    return;
+                }
+            }
+        }
+
+        bool Touched(const void *var) const {
+            return std::find(dirty_.begin(), dirty_.end(), var) != dirty_.end();
+        }
+
+        void Encode(std::string &out, const _autojson::FieldRef &field, _autojson::Scratch &scratch);
+
+        const T &obj_;
+        _autojson::Scratch scratch_;
+        std::vector<Fragment> fragments_;   //!< Cached members in the order of the previous call
+        std::vector<Fragment> next_;
+        std::vector<const void *> dirty_;
+        std::vector<std::pair<const void *, size_t>> dirty_elements_;
+        std::string buffer_;
+    };
+
+    template <typename T>
+    inline void FragmentCache<T>::Encode(std::string &out, const _autojson::FieldRef &field,
+                                         _autojson::Scratch &scratch) {
+        const _autojson::FieldOps &ops = *field.ops;
+        _autojson::Writer writer(out, scratch);
+        if (!ops.cached) {
+            ops.write(writer, field.var);
+            return;
+        }
+        Fragment fragment;
+        Take(field.var, fragment);
+#ifndef NDEBUG
+        size_t begin = out.size();
+#endif
+        size_t count = ops.count(field.var);
+        bool touched = fragment.var == nullptr || Touched(field.var);
+        if (ops.elements_cached) {
+            // a removal may have shifted the elements after it, and a growth is taken as an append
+            if (touched || count < fragment.count) {
+                fragment.elements.clear();
+            }
+            size_t cached = std::min(fragment.elements.size(), count);
+            fragment.elements.resize(count);
+            for (const std::pair<const void *, size_t> &element : dirty_elements_) {
+                if (element.first == field.var && element.second < cached) {
+                    fragment.elements[element.second].clear();
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (i >= cached || fragment.elements[i].empty()) {
+                    _autojson::Writer element_writer(fragment.elements[i], scratch);
+                    ops.write_element(element_writer, field.var, i);
+                }
+            }
+            // same layout as Writer::WriteValue of a vector
+            if (count == 0) {
+                out.append("null");
+            } else {
+                out.push_back('[');
+                for (size_t i = 0; i < count; ++i) {
+                    if (i != 0) {
+                        out.push_back(',');
+                    }
+                    out.append(fragment.elements[i]);
+                }
+                out.push_back(']');
+            }
+        } else {
+            if (touched || count != fragment.count || fragment.bytes.empty()) {
+                fragment.bytes.clear();
+                _autojson::Writer fragment_writer(fragment.bytes, scratch);
+                ops.write(fragment_writer, field.var);
+            }
+            out.append(fragment.bytes);
+        }
+#ifndef NDEBUG
+        std::string fresh;
+        _autojson::Writer fresh_writer(fresh, scratch);
+        ops.write(fresh_writer, field.var);
+        assert(out.compare(begin, std::string::npos, fresh) == 0 &&
+               "FragmentCache: a member changed without Touch");
+#endif
+        fragment.var = field.var;
+        fragment.count = count;
+        next_.push_back(std::move(fragment));
+    }
+
+    template <typename T>
+    inline void FragmentCache<T>::Marshal(std::string &json_string) {
+        json_string.clear();
+        _autojson::ScratchLease lease(scratch_);
+        _autojson::FieldSink &sink = lease.Get().sink;
+        try {
+            _autojson::_collect_fields(sink, obj_);
+            size_t end = sink.Size();
+            sink.Sort(0);
+            bool first = true;
+            for (size_t i = 0; i < end; ++i) {
+                // the same key mapped twice keeps the last declaration, as in Writer::WriteFields
+                _autojson::FieldRef field = sink.At(i);
+                if (i + 1 < end && _autojson::FieldSink::KeyCompare(sink.Key(field), field.key_length,
+                                                                    sink.Key(sink.At(i + 1)),
+                                                                    sink.At(i + 1).key_length) == 0) {
+                    continue;
+                }
+                json_string.push_back(first ? '{' : ',');
+                first = false;
+                _autojson::Writer(json_string, lease.Get()).WriteKey(sink.Key(field), field.key_length);
+                Encode(json_string, field, lease.Get());
+            }
+            if (!first) {
+                json_string.push_back('}');
+            }
+        } catch (...) {
+            json_string.clear();
+            next_.clear();
+            TouchAll();
+            throw;
+        }
+        fragments_.swap(next_);
+        next_.clear();
+        dirty_.clear();
+        dirty_elements_.clear();
+    }
+
+    /**
+     * Read-only view of a whole file. Mapped into memory on POSIX systems, so decoding from it never
+     * copies the file; elsewhere the file is read into memory.
+     */
+    class MappedFile {
+    public:
+        MappedFile() = default;
+
+        /**
+         * @param path[in] File to open, see IsOpen() for the result
+         */
+        explicit MappedFile(const std::string &path) { Open(path); }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile() { Close(); }
+
+        bool Open(const std::string &path);
+        void Close();
+
+        bool IsOpen() const { return open_; }
+        const char *Data() const { return data_; }
+        size_t Size() const { return size_; }
+
+    private:
+        const char *data_ = nullptr;
+        size_t size_ = 0;
+        bool open_ = false;
+#ifdef AUTO_JSON_HAS_FD
+        void *mapping_ = nullptr;
+#else
+        std::string content_;
+#endif
+    };
+
+#ifdef AUTO_JSON_HAS_FD
+    inline bool MappedFile::Open(const std::string &path) {
+        Close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ != 0) {
+            void *mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                return false;
+            }
+            // the parser reads front to back
+            ::madvise(mapping, size_, MADV_SEQUENTIAL);
+            mapping_ = mapping;
+            data_ = static_cast<const char *>(mapping);
+        }
+        ::close(fd);
+        open_ = true;
+        return true;
+    }
+
+    inline void MappedFile::Close() {
+        if (mapping_ != nullptr) {
+            ::munmap(mapping_, size_);
+            mapping_ = nullptr;
+        }
+        data_ = nullptr;
+        size_ = 0;
+        open_ = false;
+    }
+#else
+    inline bool MappedFile::Open(const std::string &path) {
+        Close();
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        content_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = content_.data();
+        size_ = content_.size();
+        open_ = true;
+        return true;
+    }
+
+    inline void MappedFile::Close() {
+        std::string().swap(content_);
+        data_ = nullptr;
+        size_ = 0;
+        open_ = false;
+    }
+#endif
+
+    /**
+     * Deserialized a JSON file to object, decoding straight from the mapped file
+     * @param path[in] JSON file needs to be deserialized
+     * @param obj[in,out] Object result
+     * @return false if the file can not be opened or its content is not a valid JSON object
+     */
+    template <typename T>
+    inline bool UnmarshalFile(const std::string &path, const T &obj) {
+        MappedFile file(path);
+        if (!file.IsOpen()) {
+            return false;
+        }
+        return Unmarshal(file.Data(), file.Size(), obj);
+    }
+
+    /**
+     * Reads NDJSON (JSON Lines): one object per line from a chunk source, with memory bounded by the
+     * longest line instead of the stream size. Blank lines are skipped, a trailing '\r' is ignored.
+     */
+    class LineReader {
+    public:
+        /**
+         * Fill up to 'size' bytes into 'buf', return the number of bytes read, 0 at the end
+         */
+        typedef std::function<size_t(char *buf, size_t size)> Source;
+
+        /**
+         * @param source[in] Chunk source
+         * @param max_line_length[in] Longer lines are skipped and counted in Skipped(), 0 for no limit
+         */
+        explicit LineReader(Source source, size_t max_line_length = 0)
+            : source_(std::move(source)), max_line_length_(max_line_length) {}
+
+        explicit LineReader(std::istream &in, size_t max_line_length = 0)
+            : LineReader([&in](char *buf, size_t size) -> size_t {
+                  in.read(buf, static_cast<std::streamsize>(size));
+                  return static_cast<size_t>(in.gcount());
+              }, max_line_length) {}
+
+#ifdef AUTO_JSON_HAS_FD
+        /**
+         * Read from a file descriptor, which is not closed. A read error ends the stream, see Failed().
+         */
+        explicit LineReader(int fd, size_t max_line_length = 0)
+            : LineReader([this, fd](char *buf, size_t size) -> size_t {
+                  for (;;) {
+                      ssize_t n = ::read(fd, buf, size);
+                      if (n >= 0) {
+                          return static_cast<size_t>(n);
+                      }
+                      if (errno != EINTR) {
+                          failed_ = true;
+                          return 0;
+                      }
+                  }
+              }, max_line_length) {}
+#endif
+
+        LineReader(const LineReader &) = delete;
+        LineReader &operator=(const LineReader &) = delete;
+
+        /**
+         * Deserialize the next valid line into obj, which is reset to T() first. Lines which are not
+         * a JSON object or have a syntax error (e.g. a truncated last line) are skipped and counted
+         * in Rejected(), obj is reset again after them so it never holds a half-decoded record.
+         * @return false at the end of the stream
+         */
+        template <typename T>
+        bool Next(T &obj) {
+            const char *line = nullptr;
+            size_t length = 0;
+            while (NextLine(line, length)) {
+                obj = T();
+                if (_autojson::_unmarshal(line, line + length, obj, scratch_)) {
+                    return true;
+                }
+                ++rejected_;
+                obj = T();
+            }
+            return false;
+        }
+
+        /**
+         * The next non-blank line, valid until the next call
+         * @return false at the end of the stream
+         */
+        bool NextLine(const char *&line, size_t &length);
+
+        size_t Skipped() const { return skipped_; }
+        size_t Rejected() const { return rejected_; }
+        bool Failed() const { return failed_; }
+
+    private:
+        static const size_t kChunkSize = 64 * 1024;
+
+        bool Fill();
+
+        Source source_;
+        size_t max_line_length_;
+        std::vector<char> buffer_;
+        size_t begin_ = 0;          //!< Start of the unread bytes in buffer_
+        size_t end_ = 0;            //!< End of the unread bytes in buffer_
+        bool eof_ = false;
+        bool failed_ = false;
+        size_t skipped_ = 0;
+        size_t rejected_ = 0;
+        _autojson::Scratch scratch_;
+    };
+
+    /**
+     * Writes NDJSON (JSON Lines): one marshaled object per line, buffered and handed to a sink in
+     * chunks. The destructor flushes.
+     */
+    class LineWriter {
+    public:
+        /**
+         * Consume 'size' bytes of 'data'
+         */
+        typedef std::function<void(const char *data, size_t size)> Sink;
+
+        /**
+         * @param sink[in] Chunk sink
+         * @param flush_size[in] Buffered bytes which trigger a flush
+         */
+        explicit LineWriter(Sink sink, size_t flush_size = 64 * 1024)
+            : sink_(std::move(sink)), flush_size_(flush_size) {}
+
+        explicit LineWriter(std::ostream &out, size_t flush_size = 64 * 1024)
+            : LineWriter([&out](const char *data, size_t size) {
+                  out.write(data, static_cast<std::streamsize>(size));
+              }, flush_size) {}
+
+#ifdef AUTO_JSON_HAS_FD
+        /**
+         * Write to a file descriptor, which is not closed. A write error drops the rest, see Failed().
+         */
+        explicit LineWriter(int fd, size_t flush_size = 64 * 1024)
+            : LineWriter([this, fd](const char *data, size_t size) {
+                  while (size != 0 && !failed_) {
+                      ssize_t n = ::write(fd, data, size);
+                      if (n >= 0) {
+                          data += n;
+                          size -= static_cast<size_t>(n);
+                      } else if (errno != EINTR) {
+                          failed_ = true;
+                      }
+                  }
+              }, flush_size) {}
+#endif
+
+        LineWriter(const LineWriter &) = delete;
+        LineWriter &operator=(const LineWriter &) = delete;
+
+        ~LineWriter() { Flush(); }
+
+        /**
+         * Serialize obj as the next line, an object without mapped members is written as {}
+         */
+        template <typename T>
+        void Write(const T &obj) {
+            size_t begin = buffer_.size();
+            _autojson::_marshal_append(buffer_, obj, scratch_);
+            if (buffer_.size() == begin) {
+                buffer_.append("{}");
+            }
+            buffer_.push_back('\n');
+            if (buffer_.size() >= flush_size_) {
+                Flush();
+            }
+        }
+
+        /**
+         * Hand the buffered lines to the sink
+         */
+        void Flush() {
+            if (!buffer_.empty()) {
+                sink_(buffer_.data(), buffer_.size());
+                buffer_.clear();
+            }
+        }
+
+        bool Failed() const { return failed_; }
+
+    private:
+        Sink sink_;
+        size_t flush_size_;
+        std::string buffer_;
+        bool failed_ = false;
+        _autojson::Scratch scratch_;
+    };
+
+    inline bool LineReader::Fill() {
+        if (eof_) {
+            return false;
+        }
+        // move the partial line to the front, grow only when it fills the whole buffer
+        if (begin_ != 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (buffer_.size() - end_ < kChunkSize / 2) {
+            // by value, the in-class constant has no out-of-line definition to bind a reference to
+            size_t chunk = kChunkSize;
+            buffer_.resize(std::max(buffer_.size() * 2, chunk));
+        }
+        size_t n = source_(buffer_.data() + end_, buffer_.size() - end_);
+        if (n == 0) {
+            eof_ = true;
+            return false;
+        }
+        end_ += n;
+        return true;
+    }
+
+    inline bool LineReader::NextLine(const char *&line, size_t &length) {
+        size_t scanned = 0;     // bytes of the current line already searched for '\n'
+        bool skipping = false;  // the current line is too long and is being dropped
+        for (;;) {
+            const char *data = buffer_.data();
+            size_t pending = end_ - begin_ - scanned;
+            const void *newline = pending == 0 ? nullptr : std::memchr(data + begin_ + scanned, '\n', pending);
+            size_t line_end = end_;
+            size_t next = end_;
+            if (newline != nullptr) {
+                line_end = static_cast<const char *>(newline) - data;
+                next = line_end + 1;
+            } else if (!eof_) {
+                scanned = end_ - begin_;
+                if (max_line_length_ != 0 && scanned > max_line_length_) {
+                    // drop what was read of the line, keep reading until its end
+                    skipping = true;
+                    begin_ = end_;
+                    scanned = 0;
+                }
+                Fill();
+                continue;
+            } else if (begin_ == end_) {
+                skipped_ += skipping ? 1 : 0;
+                return false;
+            }
+            size_t line_begin = begin_;
+            begin_ = next;
+            scanned = 0;
+            if (skipping || (max_line_length_ != 0 && line_end - line_begin > max_line_length_)) {
+                ++skipped_;
+                skipping = false;
+                continue;
+            }
+            if (line_end != line_begin && data[line_end - 1] == '\r') {
+                --line_end;
+            }
+            size_t first = line_begin;
+            while (first < line_end && (data[first] == ' ' || data[first] == '\t')) {
+                ++first;
+            }
+            if (first != line_end) {
+                line = data + line_begin;
+                length = line_end - line_begin;
+                return true;
+            }
+        }
+    }
+}
+
+/**
+ * Specify the mapping between member variables and JSON fields
+ */
+#ifdef AUTO_JSON_HAS_JSONCPP
+#define AUTO_JSON_MAPPING(variable, key)                                                                   \
+    if (const _autojson::MappingContext *_auto_json_context = _autojson::MappingContext::Find(this)) {    \
+        _map_in_context(*_auto_json_context, variable, key);                                              \
+    } else if (AutoJsonMethod::Marshal == this->method_) {             \
+        _marshal_into_document(variable, key);                         \
+    } else if (AutoJsonMethod::Unmarshal == this->method_) {           \
+        _unmarshal_into_obj(variable, key);                            \
+    }
+#else
+// without jsoncpp there is no legacy SetMethod mode, the library always runs the mapping in a context
+#define AUTO_JSON_MAPPING(variable, key)                                                                   \
+    if (const _autojson::MappingContext *_auto_json_context = _autojson::MappingContext::Find(this)) {    \
+        _map_in_context(*_auto_json_context, variable, key);                                              \
+    }
+#endif
+
+/**
+ * Declare the mapping of a type once as a compile-time list of AUTO_JSON_FIELD(member, key), placed
+ * after the members. Marshal/Unmarshal then run code specialized for the type instead of SetJsonMapping.
+ */
+#define AUTO_JSON_FIELDS(Class, ...)                                            \
+    typedef Class _auto_json_self_type;                                         \
+    static auto _auto_json_fields() -> decltype(std::make_tuple(__VA_ARGS__)) { \
+        return std::make_tuple(__VA_ARGS__);                                    \
+    }
+
+/**
+ * Same as AUTO_JSON_FIELDS without touching the type: the type keeps its natural size and layout.
+ * Use it at global namespace scope after the type's definition, only public members can be mapped.
+ */
+#define AUTO_JSON_TYPE_FIELDS(Class, ...)           \
+    namespace _autojson {                           \
+        template <>                                 \
+        struct ExternalFields<Class> {              \
+            AUTO_JSON_FIELDS(Class, __VA_ARGS__)    \
+        };                                          \
+    }
+
+/**
+ * Member of an AUTO_JSON_FIELDS list, the key must be a string literal
+ */
+#define AUTO_JSON_FIELD(member, key) _autojson::MakeField(&_auto_json_self_type::member, key)
+
+/**
+ * State and conversions shared by AutoJsonHelper and AutoJsonStaticHelper, derive from one of them
+ */
+class AutoJsonHelperBase {
+public:
+    void SetMethod(AutoJsonMethod method) { this->method_ = method; };
+#ifdef AUTO_JSON_HAS_JSONCPP
+    void SetDocument(const Json::Value &doc) { this->document_ = doc; this->source_ = nullptr; };
+    const Json::Value &GetDocument() const {return this->document_;};
+
+    /**
+     * Convert JSON document to JSON string
+     * @return JSON string
+     */
+    std::string GetString() {
+        std::string result;
+        GetString(result);
+        return result;
+    };
+
+    /**
+     * Convert JSON document to JSON string, reusing the capacity of 'json_string'
+     * @param json_string[in,out] JSON string, empty if the document is empty
+     */
+    void GetString(std::string &json_string) const {
+        json_string.clear();
+        if (!this->document_.empty()) {
+            _autojson::ScratchLease lease(_autojson::Scratch::Local());
+            _autojson::Writer writer(json_string, lease.Get());
+            writer.WriteDocument(this->document_);
+        }
+    };
+#endif
+
+    /**
+     * @brief Clear member variables
+     */
+    void Clear() {
+#ifdef AUTO_JSON_HAS_JSONCPP
+        this->document_.clear();
+        this->source_ = nullptr;
+#endif
+        this->method_ = AutoJsonMethod::Default;
+    };
+
+protected:
+    AutoJsonMethod method_ = AutoJsonMethod::Default; //!< Method Type. 0=>Not Init, 1=>Serialize, 2=>Deserialize
+
+    /**
+     * Map the variable in the library's per-thread context: collect it for the streaming writer
+     * or build it into the context's document node
+     */
+    template <typename T>
+    void _map_in_context(const _autojson::MappingContext &context, T &var, const std::string &json_key) const {
+        _map_in_context(context, var, json_key.data(), json_key.size());
+    }
+
+    template <typename T>
+    void _map_in_context(const _autojson::MappingContext &context, T &var, const char *json_key) const {
+        _map_in_context(context, var, json_key, std::strlen(json_key));
+    }
+
+    template <typename T>
+    static void _map_in_context(const _autojson::MappingContext &context, T &var, const char *json_key, size_t length);
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+    /**
+     * Serialize variable into JSON according to the specified keys
+     */
+    template <typename T>
+    void _marshal_into_document(T &var, const std::string &json_key);
+
+    /**
+     * Deserialize JSON into variable according to the specified keys
+     */
+    template <typename T>
+    void _unmarshal_into_obj(T &var, const std::string &json_key);
+
+private:
+    template <bool Exact = true, typename T, typename std::enable_if<_autojson::Mapping_check<T>::helper,int>::type = 0>
+    static inline bool _marshal_for_spl_(T &obj, Json::Value &dc) {
+        // build the members straight into the parent's node, obj is left untouched
+        _autojson::_map_with_context<Exact>(obj, AutoJsonMethod::Marshal, nullptr, &dc);
+        return true;
+    }
+
+    template <bool Exact = true, typename T, typename std::enable_if<_autojson::Mapping_check<T>::table,int>::type = 0>
+    static inline bool _marshal_for_spl_(T &obj, Json::Value &dc) {
+        _TableMarshaler<T> marshaler{obj, dc};
+        _autojson::FieldEach<0, _autojson::FieldTable<T>::kSize>::Apply(_autojson::FieldTable<T>::Get().fields, marshaler);
+        return true;
+    }
+
+    template <typename T, typename std::enable_if<!_autojson::Mapping_check<T>::exist,int>::type = 0>
+    static inline bool _marshal_for_spl_(T &obj, Json::Value &dc) {
+        _marshal_into_document_(obj, dc);
+        return true;
+    }
+
+    template <typename T>
+    struct _TableMarshaler {
+        T &obj;
+        Json::Value &dc;
+
+        template <typename C, typename M>
+        void operator()(size_t /*i*/, const _autojson::Field<C, M> &field) {
+            _marshal_for_spl_(obj.*field.member, dc[std::string(field.key, field.key_length)]);
+        }
+    };
+
+    template <typename T>
+    struct _TableUnmarshaler {
+        T &obj;
+        const Json::Value &node;
+
+        template <typename C, typename M>
+        void operator()(const _autojson::Field<C, M> &field) const {
+            _unmarshal_for_spl_(obj.*field.member, node);
+        }
+    };
+
+    /**
+     * Serialize core function
+     * @tparam T Basic data types other than map, vector, etc., from the STL.
+     * @param var[in] Value needs to be serialized
+     * @param dc[in,out] The Document that Value is serialized into
+     */
+    template <typename T>
+    static void _marshal_into_document_(const T &var, Json::Value &dc);
+
+    // The Overload versions of _marshal_into_document_ for STL types, with any allocator
+    template <typename A>
+    static void _marshal_into_document_(const _autojson::BasicString<A> &var, Json::Value &dc);
+
+    template <typename T, typename SA, typename A>
+    static void _marshal_into_document_(const _autojson::BasicMap<_autojson::BasicString<SA>, T, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _marshal_into_document_(const _autojson::BasicMap<long, T, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _marshal_into_document_(const _autojson::BasicMap<int, T, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename SA, typename H, typename E, typename A>
+    static void _marshal_into_document_(const _autojson::HashMap<_autojson::BasicString<SA>, T, H, E, A> &var,
+                                        Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename H, typename E, typename A>
+    static void _marshal_into_document_(const _autojson::HashMap<long, T, H, E, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename H, typename E, typename A>
+    static void _marshal_into_document_(const _autojson::HashMap<int, T, H, E, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename SA, typename A>
+    static void _marshal_into_document_(const _autojson::FlatMap<_autojson::BasicString<SA>, T, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _marshal_into_document_(const _autojson::FlatMap<long, T, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _marshal_into_document_(const _autojson::FlatMap<int, T, A> &var, Json::Value &dc) {
+        _marshal_map_into_document_(var, dc);
+    }
+
+    /**
+     * Serialize any supported map, the document sorts the keys itself
+     */
+    template <typename M>
+    static void _marshal_map_into_document_(const M &var, Json::Value &dc);
+
+    template <typename A>
+    static Json::Value &_document_member_(Json::Value &dc, const _autojson::BasicString<A> &key) {
+        return *dc.demand(key.data(), key.data() + key.size());
+    }
+
+    static Json::Value &_document_member_(Json::Value &dc, long long key) {
+        char buf[24];
+        return *dc.demand(buf, buf + _autojson::FormatInteger(buf, key));
+    }
+
+    template <typename T, typename A>
+    static void _marshal_into_document_(const std::vector<T, A> &var, Json::Value &dc);
+
+    /**
+     * @brief Check if the template type T is a custom data structure for serializing
+     */
+    template <bool Exact = true, typename T, typename std::enable_if<_autojson::Mapping_check<T>::helper,int>::type = 0>
+    static inline bool _unmarshal_for_spl_(T &obj, const Json::Value &dc) {
+        obj.Clear();
+        obj.SetMethod(AutoJsonMethod::Unmarshal);
+        if (!dc.empty() && dc.isObject()) {
+            // read the parent's node in place instead of copying it into obj's document
+            obj.source_ = &dc;
+            _autojson::MappingCall<Exact>::Run(obj);
+            obj.source_ = nullptr;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Check if the template type T is not a custom data structure for deserializing
+     */
+    template <bool Exact = true, typename T, typename std::enable_if<_autojson::Mapping_check<T>::table,int>::type = 0>
+    static inline bool _unmarshal_for_spl_(T &obj, const Json::Value &dc) {
+        if (dc.empty() || !dc.isObject()) {
+            return false;
+        }
+        // visit the document's members once, each key is dispatched through the table's hash
+        typedef _autojson::FieldTable<T> Table;
+        const Table &table = Table::Get();
+        for (Json::Value::const_iterator it = dc.begin(); it != dc.end(); ++it) {
+            const char *key_end = nullptr;
+            const char *key = it.memberName(&key_end);
+            size_t first = 0;
+            size_t last = 0;
+            table.Find(key, key_end - key, first, last);
+            for (size_t k = first; k < last; ++k) {
+                table.Visit(table.order[k], _TableUnmarshaler<T>{obj, *it});
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Check if the template type T is not a custom data structure for deserializing
+     */
+    template <typename T, typename std::enable_if<!_autojson::Mapping_check<T>::exist,int>::type = 0>
+    static inline bool _unmarshal_for_spl_(T &obj, const Json::Value &dc) {
+        _unmarshal_into_obj_(obj, dc);
+        return true;
+    }
+
+    // Deserialize core function for basic data types
+    static void _unmarshal_into_obj_(int &var, const Json::Value &dc);
+    static void _unmarshal_into_obj_(long &var, const Json::Value &dc);
+    static void _unmarshal_into_obj_(bool &var, const Json::Value &dc);
+    static void _unmarshal_into_obj_(float &var, const Json::Value &dc);
+    static void _unmarshal_into_obj_(double &var, const Json::Value &dc);
+
+    template <typename A>
+    static void _unmarshal_into_obj_(_autojson::BasicString<A> &var, const Json::Value &dc);
+
+    // The Overload versions of _unmarshal_into_obj_ for STL types, with any allocator
+    // Elements are constructed in place so that they take the container's allocator
+    // If deserialization fails, its key should not exist in var
+    template <typename T, typename SA, typename A>
+    static void _unmarshal_into_obj_(_autojson::BasicMap<_autojson::BasicString<SA>, T, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _unmarshal_into_obj_(_autojson::BasicMap<long, T, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _unmarshal_into_obj_(_autojson::BasicMap<int, T, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename SA, typename H, typename E, typename A>
+    static void _unmarshal_into_obj_(_autojson::HashMap<_autojson::BasicString<SA>, T, H, E, A> &var,
+                                     const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename H, typename E, typename A>
+    static void _unmarshal_into_obj_(_autojson::HashMap<long, T, H, E, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename H, typename E, typename A>
+    static void _unmarshal_into_obj_(_autojson::HashMap<int, T, H, E, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename SA, typename A>
+    static void _unmarshal_into_obj_(_autojson::FlatMap<_autojson::BasicString<SA>, T, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _unmarshal_into_obj_(_autojson::FlatMap<long, T, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    template <typename T, typename A>
+    static void _unmarshal_into_obj_(_autojson::FlatMap<int, T, A> &var, const Json::Value &dc) {
+        _unmarshal_map_into_obj_(var, dc);
+    }
+
+    /**
+     * Deserialize any supported map walking the document's members once, integer keys are parsed
+     * in place
+     */
+    template <typename M>
+    static void _unmarshal_map_into_obj_(M &var, const Json::Value &dc);
+
+    template <typename T, typename A>
+    static void _unmarshal_into_obj_(std::vector<T, A> &var, const Json::Value &dc);
+
+    /**
+     * @brief The document Unmarshal mode reads from
+     */
+    const Json::Value &_source() const { return this->source_ ? *this->source_ : this->document_; }
+
+private:
+    template <typename T, typename std::enable_if<_autojson::Mapping_check<T>::exist,int>::type>
+    friend void _autojson::_unmarshal(const Json::Value &root, T &obj);
+
+    template <typename T, typename std::enable_if<_autojson::Mapping_check<T>::exist,int>::type>
+    friend void _autojson::_marshal(Json::Value &root, const T &obj);
+
+    Json::Value document_;
+    const Json::Value *source_ = nullptr;   //!< Node of an enclosing document being read, instead of document_
+#endif
+};
+
+class AutoJsonHelper : public AutoJsonHelperBase {
+public:
+    AutoJsonHelper() = default;
+    ~AutoJsonHelper() = default;
+    virtual void SetJsonMapping() = 0;
+};
+
+/**
+ * AutoJsonHelper without the vtable: Derived declares a non-virtual SetJsonMapping() with the same
+ * AUTO_JSON_MAPPING body, which every Marshal/Unmarshal resolves statically and can inline.
+ * @tparam Derived The class deriving from AutoJsonStaticHelper<Derived>
+ */
+template <typename Derived>
+class AutoJsonStaticHelper : public AutoJsonHelperBase {
+public:
+    AutoJsonStaticHelper() = default;
+    AutoJsonStaticHelper(const AutoJsonStaticHelper &) = default;
+    AutoJsonStaticHelper(AutoJsonStaticHelper &&) = default;
+    AutoJsonStaticHelper &operator=(const AutoJsonStaticHelper &) = default;
+    AutoJsonStaticHelper &operator=(AutoJsonStaticHelper &&) = default;
+    ~AutoJsonStaticHelper() {
+        static_assert(_autojson::MarshalHelper_check<Derived>::exist, "Derived must declare SetJsonMapping()");
+    }
+};
+
+template <typename T>
+inline void AutoJsonHelperBase::_map_in_context(const _autojson::MappingContext &context, T &var,
+                                            const char *json_key, size_t length) {
+    if (AutoJsonMethod::Collect == context.method) {
+        context.sink->Add(var, json_key, length);
+        return;
+    }
+#ifdef AUTO_JSON_HAS_JSONCPP
+    _marshal_for_spl_(var, *context.target->demand(json_key, json_key + length));
+#endif
+}
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+namespace _autojson {
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type>
+    inline void _marshal(Json::Value &root, const T &obj) {
+        root = Json::Value();
+        // the mapping only reads obj
+        AutoJsonHelperBase::_marshal_for_spl_<false>(const_cast<T &>(obj), root);
+    }
+
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type>
+    inline void _unmarshal(const Json::Value &root, T &obj) {
+        AutoJsonHelperBase::_unmarshal_for_spl_<false>(obj, root);
+    }
+}
+
+template <typename T>
+inline void AutoJsonHelperBase::_marshal_into_document(T &var, const std::string &json_key) {
+    _marshal_for_spl_(var, this->document_[json_key]);
+}
+
+template <typename T>
+inline void AutoJsonHelperBase::_marshal_into_document_(const T &var, Json::Value &dc) {
+    dc = var;
+}
+
+template <>
+inline void AutoJsonHelperBase::_marshal_into_document_<long>(const long &var, Json::Value &dc) {
+    dc = Json::Int64(var);
+}
+
+template <>
+inline void AutoJsonHelperBase::_marshal_into_document_<float>(const float &var, Json::Value &dc) {
+    dc = _autojson::FloatToDouble(var);
+}
+
+template<typename A>
+inline void AutoJsonHelperBase::_marshal_into_document_(const _autojson::BasicString<A> &var, Json::Value &dc) {
+    dc = Json::Value(var.data(), var.data() + var.size());
+}
+
+template<typename M>
+inline void AutoJsonHelperBase::_marshal_map_into_document_(const M &var, Json::Value &dc) {
+    typedef typename M::value_type::second_type T;
+    for (const auto &it_var : var) {
+        _marshal_for_spl_(const_cast<T&>(it_var.second), _document_member_(dc, it_var.first));
+    }
+}
+
+template<typename T, typename A>
+inline void AutoJsonHelperBase::_marshal_into_document_(const std::vector<T, A> &var, Json::Value &dc) {
+    if (!var.empty()) {
+        dc.resize(static_cast<Json::ArrayIndex>(var.size()));
+    }
+    for (Json::ArrayIndex i = 0; i < var.size(); ++i) {
+        _marshal_for_spl_(const_cast<T&>(var[i]), dc[i]);
+    }
+}
+
+template <typename T>
+inline void AutoJsonHelperBase::_unmarshal_into_obj(T &var, const std::string &json_key) {
+    const Json::Value *dc = this->_source().find(json_key.data(), json_key.data() + json_key.size());
+    if (dc != nullptr) {
+        _unmarshal_for_spl_(var, *dc);
+    }
+}
+
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(int &var, const Json::Value &dc) {
+    if (dc.isIntegral()) {
+        var = dc.asInt();
+    }
+}
+
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(long &var, const Json::Value &dc) {
+    if (dc.isIntegral()) {
+        var = dc.asInt64();
+    }
+}
+
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(bool &var, const Json::Value &dc) {
+    if (dc.isBool()) {
+        var = dc.asBool();
+    }
+}
+
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(float &var, const Json::Value &dc) {
+    if (dc.isDouble()) {
+        var = dc.asFloat();
+    }
+}
+
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(double &var, const Json::Value &dc) {
+    if (dc.isDouble()) {
+        var = dc.asDouble();
+    }
+}
+
+template <typename A>
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(_autojson::BasicString<A> &var, const Json::Value &dc) {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    if (dc.isString() && dc.getString(&begin, &end)) {
+        var.assign(begin, end);
+    }
+}
+
+template <typename M>
+inline void AutoJsonHelperBase::_unmarshal_map_into_obj_(M &var, const Json::Value &dc) {
+    typedef typename std::remove_const<typename M::value_type::first_type>::type K;
+    if (dc.isObject()) {
+        _autojson::MapBuilder<M> builder(var);
+        builder.Begin(dc.size());
+        for (Json::Value::const_iterator it = dc.begin(); it != dc.end(); ++it) {
+            const char *key_end = nullptr;
+            const char *key = it.memberName(&key_end);
+            auto *value = _autojson::_emplace_key<K>(builder, key, key_end - key, std::is_integral<K>());
+            if (value != nullptr && !_unmarshal_for_spl_(*value, *it)) {
+                builder.Drop();
+            }
+        }
+        builder.End();
+    }
+}
+
+template <typename T, typename A>
+inline void AutoJsonHelperBase::_unmarshal_into_obj_(std::vector<T, A> &var, const Json::Value &dc) {
+    if (dc.isArray()) {
+        var.clear();
         for (int i = 0; i < dc.size(); ++i) {
-            T item;
-            if (_unmarshal_for_spl_(item, dc[i])) {
-                var.template emplace_back(item);
+            var.emplace_back();
+            if (!_unmarshal_for_spl_(var.back(), dc[i])) {
+                var = std::vector<T, A>(var.get_allocator());
+                return;
+            }
+        }
+    }
+}
+#endif
+
+
+namespace _autojson {
+    inline void Writer::WriteInteger(long long var) {
+        char buf[24];
+        out_.append(buf, FormatInteger(buf, var));
+    }
+
+    inline void Writer::WriteValue(double var) { WriteReal(var); }
+
+    inline void Writer::WriteValue(float var) {
+#ifdef AUTO_JSON_LEGACY_NUMBERS
+        WriteReal(static_cast<double>(var));
+#else
+        WriteReal(var);
+#endif
+    }
+
+    template <typename F>
+    inline void Writer::WriteReal(F var) {
+        // Same special values as Json::valueToString(double)
+        if (var != var) {
+            out_.append("null");
+            return;
+        }
+        if (var > std::numeric_limits<F>::max() || var < -std::numeric_limits<F>::max()) {
+            out_.append(var < 0 ? "-1e+9999" : "1e+9999");
+            return;
+        }
+        char buf[40];
+#ifndef AUTO_JSON_LEGACY_NUMBERS
+        out_.append(buf, FormatShortest(buf, var));
+#else
+        int length = std::snprintf(buf, sizeof(buf), "%.17g", static_cast<double>(var));
+        bool has_dot = false;
+        for (int i = 0; i < length; ++i) {
+            if (buf[i] == ',') {
+                buf[i] = '.';   // decimal comma of the current locale
+            }
+            if (buf[i] == '.' || buf[i] == 'e') {
+                has_dot = true;
+            }
+        }
+        out_.append(buf, static_cast<size_t>(length));
+        if (!has_dot) {
+            out_.append(".0");
+        }
+#endif
+    }
+
+    /**
+     * Escape the string the way Json::FastWriter does: control characters and non-ASCII
+     * characters are written as \uXXXX, invalid UTF-8 sequences become U+FFFD
+     */
+    inline void Writer::WriteString(const char *str, size_t length) {
+        static const char hex[] = "0123456789abcdef";
+        auto append_hex = [this](unsigned int code) {
+            char buf[6] = {'\\', 'u', hex[(code >> 12) & 0xF], hex[(code >> 8) & 0xF],
+                           hex[(code >> 4) & 0xF], hex[code & 0xF]};
+            out_.append(buf, sizeof(buf));
+        };
+
+        out_.push_back('"');
+        const char *end = str + length;
+        const char *plain = str;
+        for (const char *c = StringScan::Escape(str, end); c < end; c = StringScan::Escape(c + 1, end)) {
+            unsigned char ch = static_cast<unsigned char>(*c);
+            out_.append(plain, static_cast<size_t>(c - plain));
+            switch (ch) {
+                case '"': out_.append("\\\""); break;
+                case '\\': out_.append("\\\\"); break;
+                case '\b': out_.append("\\b"); break;
+                case '\f': out_.append("\\f"); break;
+                case '\n': out_.append("\\n"); break;
+                case '\r': out_.append("\\r"); break;
+                case '\t': out_.append("\\t"); break;
+                default: {
+                    unsigned int code = 0xFFFD;
+                    if (ch < 0x80) {
+                        code = ch;
+                    } else if (ch < 0xE0) {
+                        if (end - c >= 2) {
+                            code = ((ch & 0x1Fu) << 6) | (static_cast<unsigned char>(c[1]) & 0x3Fu);
+                            c += 1;
+                            code = code < 0x80 ? 0xFFFD : code;
+                        }
+                    } else if (ch < 0xF0) {
+                        if (end - c >= 3) {
+                            code = ((ch & 0x0Fu) << 12) | ((static_cast<unsigned char>(c[1]) & 0x3Fu) << 6) |
+                                   (static_cast<unsigned char>(c[2]) & 0x3Fu);
+                            c += 2;
+                            code = (code < 0x800 || (code >= 0xD800 && code <= 0xDFFF)) ? 0xFFFD : code;
+                        }
+                    } else if (ch < 0xF8) {
+                        if (end - c >= 4) {
+                            code = ((ch & 0x07u) << 18) | ((static_cast<unsigned char>(c[1]) & 0x3Fu) << 12) |
+                                   ((static_cast<unsigned char>(c[2]) & 0x3Fu) << 6) |
+                                   (static_cast<unsigned char>(c[3]) & 0x3Fu);
+                            c += 3;
+                            code = code < 0x10000 ? 0xFFFD : code;
+                        }
+                    }
+                    if (code < 0x10000) {
+                        append_hex(code);
+                    } else {
+                        code -= 0x10000;
+                        append_hex(0xD800 + ((code >> 10) & 0x3FF));
+                        append_hex(0xDC00 + (code & 0x3FF));
+                    }
+                    break;
+                }
+            }
+            plain = c + 1;
+        }
+        out_.append(plain, static_cast<size_t>(end - plain));
+        out_.push_back('"');
+    }
+
+#ifdef AUTO_JSON_HAS_JSONCPP
+    inline void Writer::WriteDocument(const Json::Value &root) {
+        switch (root.type()) {
+            case Json::nullValue:
+                out_.append("null");
+                break;
+            case Json::intValue:
+                WriteInteger(root.asLargestInt());
+                break;
+            case Json::uintValue: {
+                char buf[24];
+                int length = std::snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(root.asLargestUInt()));
+                out_.append(buf, length);
+                break;
+            }
+            case Json::realValue:
+                WriteValue(root.asDouble());
+                break;
+            case Json::stringValue: {
+                const char *begin = nullptr;
+                const char *end = nullptr;
+                root.getString(&begin, &end);
+                WriteString(begin, end - begin);
+                break;
+            }
+            case Json::booleanValue:
+                WriteValue(root.asBool());
+                break;
+            case Json::arrayValue:
+                out_.push_back('[');
+                for (Json::ArrayIndex i = 0; i < root.size(); ++i) {
+                    if (i != 0) {
+                        out_.push_back(',');
+                    }
+                    WriteDocument(root[i]);
+                }
+                out_.push_back(']');
+                break;
+            case Json::objectValue:
+                // members are iterated in key order, like Json::FastWriter's getMemberNames()
+                out_.push_back('{');
+                for (Json::Value::const_iterator it = root.begin(); it != root.end(); ++it) {
+                    if (it != root.begin()) {
+                        out_.push_back(',');
+                    }
+                    const char *key_end = nullptr;
+                    const char *key = it.memberName(&key_end);
+                    WriteKey(key, key_end - key);
+                    WriteDocument(*it);
+                }
+                out_.push_back('}');
+                break;
+        }
+    }
+#endif
+
+    inline void Writer::WriteFields(size_t begin) {
+        sink_.Sort(begin);
+        size_t end = sink_.Size();
+        size_t node = node_;
+        bool first = true;
+        out_.push_back('{');
+        for (size_t i = begin; i < end; ++i) {
+            // the same key mapped twice keeps the last declaration, like Json::Value does
+            FieldRef field = sink_.At(i);
+            if (i + 1 < end) {
+                const FieldRef &next = sink_.At(i + 1);
+                if (FieldSink::KeyCompare(sink_.Key(field), field.key_length,
+                                          sink_.Key(next), next.key_length) == 0) {
+                    continue;
+                }
+            }
+            size_t child = kNoField;
+            if (node != kNoField && !mask_->Select(node, sink_.Key(field), field.key_length, child)) {
+                continue;
+            }
+            if (!first) {
+                out_.push_back(',');
+            }
+            first = false;
+            WriteKey(sink_.Key(field), field.key_length);
+            node_ = child;
+            field.ops->write(*this, field.var);
+        }
+        node_ = node;
+        out_.push_back('}');
+    }
+
+    template <typename T, typename A>
+    inline void Writer::WriteValue(const std::vector<T, A> &var) {
+        // empty containers are never assigned into the document and stay null
+        if (var.empty()) {
+            out_.append("null");
+            return;
+        }
+        out_.push_back('[');
+        bool first = true;
+        for (const T &item : var) {
+            if (!first) {
+                out_.push_back(',');
+            }
+            first = false;
+            WriteValue(item);
+        }
+        out_.push_back(']');
+    }
+
+    template <typename T, typename SA, typename A>
+    inline void Writer::WriteValue(const BasicMap<BasicString<SA>, T, A> &var) {
+        if (var.empty()) {
+            out_.append("null");
+            return;
+        }
+        out_.push_back('{');
+        bool first = true;
+        for (const auto &it_var : var) {
+            if (!first) {
+                out_.push_back(',');
+            }
+            first = false;
+            WriteString(it_var.first.data(), it_var.first.size());
+            out_.push_back(':');
+            WriteValue(it_var.second);
+        }
+        out_.push_back('}');
+    }
+
+    template <typename M>
+    inline void Writer::WriteIntegerKeyMap(const M &var) {
+        typedef typename M::value_type::second_type T;
+        if (var.empty()) {
+            out_.append("null");
+            return;
+        }
+        // integer keys are ordered as strings in the document ("10" < "9")
+        size_t begin = int_keys_.size();
+        for (const auto &it_var : var) {
+            IntegerKey key;
+            key.length = FormatInteger(key.buf, static_cast<long long>(it_var.first));
+            key.value = &it_var.second;
+            int_keys_.push_back(key);
+        }
+        auto less = [](const IntegerKey &a, const IntegerKey &b) {
+            return FieldSink::KeyCompare(a.buf, a.length, b.buf, b.length) < 0;
+        };
+        if (!std::is_sorted(int_keys_.begin() + begin, int_keys_.end(), less)) {
+            std::sort(int_keys_.begin() + begin, int_keys_.end(), less);
+        }
+        out_.push_back('{');
+        size_t end = int_keys_.size();
+        for (size_t i = begin; i < end; ++i) {
+            if (i != begin) {
+                out_.push_back(',');
+            }
+            IntegerKey key = int_keys_[i];
+            WriteString(key.buf, key.length);
+            out_.push_back(':');
+            WriteValue(*static_cast<const T *>(key.value));
+        }
+        out_.push_back('}');
+        int_keys_.resize(begin);
+    }
+
+    template <typename M>
+    inline void Writer::WriteStringKeyMap(const M &var) {
+        typedef typename M::value_type::second_type T;
+        if (var.empty()) {
+            out_.append("null");
+            return;
+        }
+        // the document orders keys as std::string does, a hash map is sorted here
+        size_t begin = str_keys_.size();
+        for (const auto &it_var : var) {
+            str_keys_.push_back(StringKey{it_var.first.data(), it_var.first.size(), &it_var.second});
+        }
+        auto less = [](const StringKey &a, const StringKey &b) {
+            return FieldSink::KeyCompare(a.key, a.length, b.key, b.length) < 0;
+        };
+        if (!std::is_sorted(str_keys_.begin() + begin, str_keys_.end(), less)) {
+            std::sort(str_keys_.begin() + begin, str_keys_.end(), less);
+        }
+        out_.push_back('{');
+        size_t end = str_keys_.size();
+        for (size_t i = begin; i < end; ++i) {
+            if (i != begin) {
+                out_.push_back(',');
+            }
+            StringKey key = str_keys_[i];
+            WriteString(key.key, key.length);
+            out_.push_back(':');
+            WriteValue(*static_cast<const T *>(key.value));
+        }
+        out_.push_back('}');
+        str_keys_.resize(begin);
+    }
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type>
+    inline bool Writer::WriteObject(const T &obj) {
+        size_t begin = sink_.Size();
+        sink_.Collect<Exact>(obj);
+        if (sink_.Size() == begin) {
+            return false;
+        }
+        WriteFields(begin);
+        sink_.Resize(begin);
+        return true;
+    }
+
+    template <typename T>
+    struct TableWriter {
+        Writer &writer;
+        const T &obj;
+
+        template <typename C, typename M>
+        void operator()(const Field<C, M> &field) const {
+            writer.WriteValue(obj.*field.member);
+        }
+    };
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type>
+    inline bool Writer::WriteObject(const T &obj) {
+        typedef FieldTable<T> Table;
+        const Table &table = Table::Get();
+        if (table.write_count == 0) {
+            return false;
+        }
+        size_t node = node_;
+        bool first = true;
+        out_.push_back('{');
+        for (size_t k = 0; k < table.write_count; ++k) {
+            size_t i = table.write_order[k];
+            size_t child = kNoField;
+            if (node != kNoField && !mask_->Select(node, table.keys[i], table.lengths[i], child)) {
+                continue;
+            }
+            if (!first) {
+                out_.push_back(',');
+            }
+            first = false;
+            out_.append(table.prefix[i]);
+            node_ = child;
+            table.Visit(i, TableWriter<T>{*this, obj});
+        }
+        node_ = node;
+        out_.push_back('}');
+        return true;
+    }
+
+    inline void Parser::SkipSpace() {
+        while (cur_ < end_) {
+            char c = *cur_;
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                ++cur_;
+            } else if (c == '/' && end_ - cur_ >= 2 && cur_[1] == '*') {
+                const char *p = cur_ + 2;
+                while (p + 1 < end_ && !(p[0] == '*' && p[1] == '/')) {
+                    ++p;
+                }
+                cur_ = p + 1 < end_ ? p + 2 : end_;
+            } else if (c == '/' && end_ - cur_ >= 2 && cur_[1] == '/') {
+                while (cur_ < end_ && *cur_ != '\n' && *cur_ != '\r') {
+                    ++cur_;
+                }
             } else {
-                var = std::vector<T>{};
                 return;
             }
         }
     }
-}
 
-template <typename T>
-inline void AutoJsonHelper::_unmarshal_into_obj_(std::map<int, T> &var, const Json::Value &dc) {
-    if (dc.isObject()) {
+    inline bool Parser::ConsumeEmptyObject() {
+        const char *save = cur_;
+        ++cur_;
+        SkipSpace();
+        if (Peek() == '}') {
+            ++cur_;
+            return true;
+        }
+        cur_ = save;
+        return false;
+    }
+
+    inline bool Parser::ConsumeLiteral(const char *literal, size_t length) {
+        if (static_cast<size_t>(end_ - cur_) < length || std::memcmp(cur_, literal, length) != 0) {
+            return Fail();
+        }
+        cur_ += length;
+        return true;
+    }
+
+    inline bool Parser::SkipString() {
+        ++cur_;
+        while ((cur_ = StringScan::Quote(cur_, end_)) < end_) {
+            if (*cur_++ == '"') {
+                return true;
+            }
+            if (cur_ == end_) {
+                break;
+            }
+            ++cur_;
+        }
+        return Fail();
+    }
+
+    /**
+     * Read ',' or '}' after an object member, done is set when the object ends
+     */
+    inline bool Parser::NextMember(bool &done) {
+        SkipSpace();
+        char c = Peek();
+        if (c == ',') {
+            done = false;
+        } else if (c == '}') {
+            done = true;
+        } else {
+            return Fail();
+        }
+        ++cur_;
+        return true;
+    }
+
+    inline bool Parser::SkipValue() {
+        SkipSpace();
+        char c = Peek();
+        if (c == '"') {
+            return SkipString();
+        }
+        if (c == '{' || c == '[') {
+            if (++depth_ > kMaxDepth) {
+                return Fail();
+            }
+            char close = c == '{' ? '}' : ']';
+            ++cur_;
+            SkipSpace();
+            bool done = Peek() == close;
+            if (done) {
+                ++cur_;
+            }
+            while (!done) {
+                if (c == '{') {
+                    SkipSpace();
+                    if (Peek() != '"' || !SkipString()) {
+                        return Fail();
+                    }
+                    SkipSpace();
+                    if (Peek() != ':') {
+                        return Fail();
+                    }
+                    ++cur_;
+                }
+                if (!SkipValue()) {
+                    return false;
+                }
+                SkipSpace();
+                if (Peek() == close) {
+                    done = true;
+                } else if (Peek() != ',') {
+                    return Fail();
+                }
+                ++cur_;
+            }
+            --depth_;
+            return true;
+        }
+        if (c == 't') {
+            return ConsumeLiteral("true", 4);
+        }
+        if (c == 'f') {
+            return ConsumeLiteral("false", 5);
+        }
+        if (c == 'n') {
+            return ConsumeLiteral("null", 4);
+        }
+        Number number;
+        return ReadNumber(number);
+    }
+
+    /**
+     * Read a number with the rules of Json::Reader: integers that fit into 64 bits are kept
+     * as integers, everything else is a double. Returns false on a non-number or a syntax error.
+     */
+    inline bool Parser::ReadNumber(Number &number) {
+        const char *begin = cur_;
+        const char *p = cur_;
+        if (p < end_ && *p == '-') {
+            ++p;
+        }
+        if (p == end_ || ((*p < '0' || *p > '9') && (*p != '.' || p == begin))) {
+            return Fail();
+        }
+        bool is_integer = true;
+        while (p < end_ && *p >= '0' && *p <= '9') {
+            ++p;
+        }
+        if (p < end_ && *p == '.') {
+            is_integer = false;
+            ++p;
+            while (p < end_ && *p >= '0' && *p <= '9') {
+                ++p;
+            }
+        }
+        if (p < end_ && (*p == 'e' || *p == 'E')) {
+            is_integer = false;
+            ++p;
+            if (p < end_ && (*p == '+' || *p == '-')) {
+                ++p;
+            }
+            while (p < end_ && *p >= '0' && *p <= '9') {
+                ++p;
+            }
+        }
+        cur_ = p;
+
+        if (is_integer) {
+            bool negative = *begin == '-';
+            unsigned long long limit = negative ? 9223372036854775808ULL : 18446744073709551615ULL;
+            unsigned long long value = 0;
+            const char *d = negative ? begin + 1 : begin;
+            for (; d < p; ++d) {
+                unsigned digit = static_cast<unsigned>(*d - '0');
+                if (value > (limit - digit) / 10) {
+                    break;
+                }
+                value = value * 10 + digit;
+            }
+            if (d == p && p != begin + (negative ? 1 : 0)) {
+                if (negative) {
+                    number.type = Number::Int;
+                    number.int_value = value == limit ? std::numeric_limits<long long>::min()
+                                                      : -static_cast<long long>(value);
+                } else if (value <= static_cast<unsigned long long>(std::numeric_limits<long long>::max())) {
+                    number.type = Number::Int;
+                    number.int_value = static_cast<long long>(value);
+                } else {
+                    number.type = Number::UInt;
+                    number.uint_value = value;
+                }
+                return true;
+            }
+        }
+
+        // too large for an integer or a real number
+        number.type = Number::Real;
+#ifdef AUTO_JSON_HAS_TO_CHARS
+        // locale independent, strtod is left for overflow and underflow only
+        std::from_chars_result result = std::from_chars(begin, p, number.real_value);
+        if (result.ec != std::errc::result_out_of_range) {
+            return result.ec == std::errc() && result.ptr == p ? true : Fail();
+        }
+#endif
+        char buf[64];
+        std::string long_buf;
+        size_t length = static_cast<size_t>(p - begin);
+        const char *str = buf;
+        if (length < sizeof(buf)) {
+            std::memcpy(buf, begin, length);
+            buf[length] = '\0';
+        } else {
+            long_buf.assign(begin, length);
+            str = long_buf.c_str();
+        }
+        char *parsed_end = nullptr;
+        number.real_value = std::strtod(str, &parsed_end);
+        if (parsed_end != str + length) {
+            return Fail();
+        }
+        return true;
+    }
+
+    template <typename S>
+    inline bool Parser::ReadStringInto(S &out) {
+        ++cur_;
+        out.clear();
+        const char *plain = cur_;
+        while ((cur_ = StringScan::Quote(cur_, end_)) < end_) {
+            if (*cur_ == '"') {
+                out.append(plain, static_cast<size_t>(cur_ - plain));
+                ++cur_;
+                return true;
+            }
+            out.append(plain, static_cast<size_t>(cur_ - plain));
+            if (++cur_ == end_) {
+                return Fail();
+            }
+            char escape = *cur_++;
+            switch (escape) {
+                case '"': out.push_back('"'); break;
+                case '/': out.push_back('/'); break;
+                case '\\': out.push_back('\\'); break;
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'u': {
+                    auto read_hex = [this](unsigned int &code) {
+                        if (end_ - cur_ < 4) {
+                            return false;
+                        }
+                        code = 0;
+                        for (int i = 0; i < 4; ++i) {
+                            char h = *cur_++;
+                            code <<= 4;
+                            if (h >= '0' && h <= '9') {
+                                code += static_cast<unsigned int>(h - '0');
+                            } else if (h >= 'a' && h <= 'f') {
+                                code += static_cast<unsigned int>(h - 'a' + 10);
+                            } else if (h >= 'A' && h <= 'F') {
+                                code += static_cast<unsigned int>(h - 'A' + 10);
+                            } else {
+                                return false;
+                            }
+                        }
+                        return true;
+                    };
+                    unsigned int code = 0;
+                    if (!read_hex(code)) {
+                        return Fail();
+                    }
+                    if (code >= 0xD800 && code <= 0xDBFF) {
+                        // the second half of a surrogate pair must follow
+                        unsigned int low = 0;
+                        if (end_ - cur_ < 6 || cur_[0] != '\\' || cur_[1] != 'u') {
+                            return Fail();
+                        }
+                        cur_ += 2;
+                        if (!read_hex(low)) {
+                            return Fail();
+                        }
+                        code = 0x10000 + ((code & 0x3FF) << 10) + (low & 0x3FF);
+                    }
+                    if (code <= 0x7F) {
+                        out.push_back(static_cast<char>(code));
+                    } else if (code <= 0x7FF) {
+                        out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                    } else if (code <= 0xFFFF) {
+                        out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                    } else if (code <= 0x10FFFF) {
+                        out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+                        out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+                        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                    }
+                    break;
+                }
+                default:
+                    return Fail();
+            }
+            plain = cur_;
+        }
+        return Fail();
+    }
+
+    /**
+     * Read an object key followed by ':'. Keys without escapes point into the input.
+     */
+    inline bool Parser::ReadKey(const char *&key, size_t &key_length) {
+        SkipSpace();
+        if (Peek() != '"') {
+            return Fail();
+        }
+        const char *p = StringScan::Quote(cur_ + 1, end_);
+        if (p < end_ && *p == '"') {
+            key = cur_ + 1;
+            key_length = static_cast<size_t>(p - key);
+            cur_ = p + 1;
+        } else {
+            if (!ReadStringInto(key_)) {
+                return false;
+            }
+            key = key_.data();
+            key_length = key_.size();
+        }
+        SkipSpace();
+        if (Peek() != ':') {
+            return Fail();
+        }
+        ++cur_;
+        SkipSpace();
+        return true;
+    }
+
+    /**
+     * Read the value if it is a number, other values are skipped and false is returned
+     */
+    inline bool Parser::ReadNumberValue(Number &number) {
+        SkipSpace();
+        char c = Peek();
+        if (c != '-' && (c < '0' || c > '9')) {
+            SkipValue();
+            return false;
+        }
+        return ReadNumber(number);
+    }
+
+    inline bool Parser::ReadValue(int &var) {
+        Number number;
+        if (ReadNumberValue(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    inline bool Parser::ReadValue(long &var) {
+        Number number;
+        if (ReadNumberValue(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    inline bool Parser::ReadValue(bool &var) {
+        SkipSpace();
+        char c = Peek();
+        if (c == 't') {
+            if (ConsumeLiteral("true", 4)) {
+                var = true;
+            }
+        } else if (c == 'f') {
+            if (ConsumeLiteral("false", 5)) {
+                var = false;
+            }
+        } else {
+            SkipValue();
+        }
+        return true;
+    }
+
+    inline bool Parser::ReadValue(double &var) {
+        Number number;
+        if (ReadNumberValue(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    inline bool Parser::ReadValue(float &var) {
+        Number number;
+        if (ReadNumberValue(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    template <typename A>
+    inline bool Parser::ReadValue(BasicString<A> &var) {
+        SkipSpace();
+        if (Peek() != '"') {
+            return SkipValue(), true;
+        }
+        ReadStringInto(var);
+        return true;
+    }
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type>
+    inline void Parser::ReadObject(T &obj) {
+        // cur_ is at the '{' of a non-empty object
+        if (++depth_ > kMaxDepth) {
+            Fail();
+            return;
+        }
+        ++cur_;
+        size_t begin = sink_.Size();
+        sink_.Collect<Exact>(obj);
+        size_t slot_begin = slots_.size();
+        size_t mask = _index_frame(sink_, slots_, begin);
+        size_t node = node_;
+        bool done = false;
+        while (!done) {
+            const char *key = nullptr;
+            size_t key_length = 0;
+            if (!ReadKey(key, key_length)) {
+                break;
+            }
+            size_t i = _find_field(sink_, slots_, slot_begin, mask, key, key_length);
+            size_t child = kNoField;
+            if (i != kNoField && node != kNoField && !mask_->Select(node, key, key_length, child)) {
+                i = kNoField;
+            }
+            if (i == kNoField) {
+                SkipValue();
+            }
+            // every member mapped to the key gets the value
+            const char *value = cur_;
+            node_ = child;
+            for (; i != kNoField && !failed_; i = sink_.At(i).next) {
+                cur_ = value;
+                sink_.At(i).ops->read(*this, sink_.At(i).var);
+            }
+            node_ = node;
+            if (failed_ || !NextMember(done)) {
+                break;
+            }
+        }
+        slots_.resize(slot_begin);
+        sink_.Resize(begin);
+        --depth_;
+    }
+
+    inline bool Parser::SplitArray(std::vector<Span> &elements) {
+        SkipSpace();
+        if (Peek() != '[') {
+            return false;
+        }
+        ++cur_;
+        SkipSpace();
+        if (Peek() == ']') {
+            ++cur_;
+            return true;
+        }
+        for (;;) {
+            SkipSpace();
+            const char *begin = cur_;
+            if (!SkipValue()) {
+                return false;
+            }
+            elements.push_back(Span{begin, cur_});
+            SkipSpace();
+            if (Peek() == ']') {
+                ++cur_;
+                return true;
+            }
+            if (Peek() != ',') {
+                return Fail();
+            }
+            ++cur_;
+        }
+    }
+
+    inline bool Parser::SplitObject(std::vector<Member> &members, std::string &keys) {
+        SkipSpace();
+        if (Peek() != '{') {
+            return false;
+        }
+        if (ConsumeEmptyObject()) {
+            return true;
+        }
+        ++cur_;
+        bool done = false;
+        while (!done) {
+            const char *key = nullptr;
+            size_t key_length = 0;
+            if (!ReadKey(key, key_length)) {
+                return false;
+            }
+            Member member = {keys.size(), key_length, Span{cur_, cur_}};
+            keys.append(key, key_length);
+            if (!SkipValue()) {
+                return false;
+            }
+            member.value.end = cur_;
+            members.push_back(member);
+            if (!NextMember(done)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Read element 'index', decoded over the existing one when reused, else constructed in place at
+     * the end of the vector so that it takes the vector's allocator. On failure the element is left
+     * there and the caller drops the vector.
+     */
+    template <typename T, typename A>
+    inline bool Parser::ReadElement(std::vector<T, A> &var, size_t index) {
+        if (index == var.size()) {
+            var.emplace_back();
+        }
+        return ReadValue(var[index]);
+    }
+
+    template <typename A>
+    inline bool Parser::ReadElement(std::vector<bool, A> &var, size_t index) {
+        bool item = index < var.size() && var[index];
+        bool ok = ReadValue(item);
+        if (index == var.size()) {
+            var.push_back(item);
+        } else {
+            var[index] = item;
+        }
+        return ok;
+    }
+
+    template <typename T, typename A>
+    inline bool Parser::ReadValue(std::vector<T, A> &var) {
+        SkipSpace();
+        if (Peek() != '[') {
+            return SkipValue(), true;
+        }
+        if (++depth_ > kMaxDepth) {
+            return Fail();
+        }
+        ++cur_;
+        if (!reuse_) {
+            var.clear();
+        }
+        SkipSpace();
+        bool done = Peek() == ']';
+        if (done) {
+            ++cur_;
+        }
+        bool ok = true;
+        size_t count = 0;
+        while (!done) {
+            if (ok && !ReadElement(var, count++)) {
+                // one element failed, the whole vector is dropped
+                ok = false;
+                if (reuse_) {
+                    var.clear();
+                } else {
+                    var = std::vector<T, A>(var.get_allocator());
+                }
+            } else if (!ok) {
+                SkipValue();
+            }
+            if (failed_) {
+                return false;
+            }
+            SkipSpace();
+            if (Peek() == ']') {
+                done = true;
+            } else if (Peek() != ',') {
+                return Fail();
+            }
+            ++cur_;
+        }
+        if (ok && count < var.size()) {
+            // elements left from the previous content of a reused vector
+            var.erase(var.begin() + static_cast<std::ptrdiff_t>(count), var.end());
+        }
+        --depth_;
+        return true;
+    }
+
+    template <typename M>
+    inline bool Parser::ReadMap(M &var) {
+        typedef typename std::remove_const<typename M::value_type::first_type>::type K;
+        SkipSpace();
+        if (Peek() != '{') {
+            return SkipValue(), true;
+        }
+        MapBuilder<M> builder(var, reuse_ ? &touched_ : nullptr);
+        builder.Begin(0);
+        if (ConsumeEmptyObject()) {
+            builder.End();
+            return true;
+        }
+        if (++depth_ > kMaxDepth) {
+            return Fail();
+        }
+        ++cur_;
+        bool done = false;
+        while (!done) {
+            const char *key = nullptr;
+            size_t key_length = 0;
+            if (!ReadKey(key, key_length)) {
+                break;
+            }
+            // the value is built in place from the key, without a temporary string
+            auto *value = _emplace_key<K>(builder, key, key_length, std::is_integral<K>());
+            if (value == nullptr) {
+                SkipValue();
+            } else if (!ReadValue(*value)) {
+                builder.Drop();
+            }
+            if (failed_ || !NextMember(done)) {
+                break;
+            }
+        }
+        // the members before a syntax error are kept
+        builder.End();
+        if (failed_) {
+            return false;
+        }
+        --depth_;
+        return true;
+    }
+
+    template <typename T>
+    struct TableReader {
+        Parser &parser;
+        T &obj;
+
+        template <typename C, typename M>
+        void operator()(const Field<C, M> &field) const {
+            parser.ReadValue(obj.*field.member);
+        }
+    };
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type>
+    inline void Parser::ReadObject(T &obj) {
+        // cur_ is at the '{' of a non-empty object
+        typedef FieldTable<T> Table;
+        if (++depth_ > kMaxDepth) {
+            Fail();
+            return;
+        }
+        ++cur_;
+        const Table &table = Table::Get();
+        size_t node = node_;
+        bool done = false;
+        while (!done) {
+            const char *key = nullptr;
+            size_t key_length = 0;
+            if (!ReadKey(key, key_length)) {
+                return;
+            }
+            size_t first = 0;
+            size_t last = 0;
+            table.Find(key, key_length, first, last);
+            size_t child = kNoField;
+            if (first != last && node != kNoField && !mask_->Select(node, key, key_length, child)) {
+                last = first;
+            }
+            if (first == last) {
+                SkipValue();
+            }
+            // every member mapped to the key gets the value
+            const char *value = cur_;
+            node_ = child;
+            for (size_t k = first; k < last && !failed_; ++k) {
+                cur_ = value;
+                table.Visit(table.order[k], TableReader<T>{*this, obj});
+            }
+            node_ = node;
+            if (failed_ || !NextMember(done)) {
+                return;
+            }
+        }
+        --depth_;
+    }
+
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type>
+    inline bool Parser::ReadValue(T &obj) {
+        SkipSpace();
+        if (Peek() != '{') {
+            SkipValue();
+            return false;
+        }
+        if (ConsumeEmptyObject()) {
+            return false;
+        }
+        ReadObject(obj);
+        return !failed_;
+    }
+
+    inline void Packer::PutBig(uint64_t value, size_t bytes) {
+        for (size_t i = bytes; i-- > 0;) {
+            out_.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    inline void Packer::PackInteger(long long var) {
+        // the shortest of the integer formats
+        uint64_t bits = static_cast<uint64_t>(var);
+        if (var >= 0) {
+            if (var < 0x80) {
+                out_.push_back(static_cast<char>(var));
+            } else if (var <= 0xff) {
+                out_.push_back(static_cast<char>(0xcc));
+                PutBig(bits, 1);
+            } else if (var <= 0xffff) {
+                out_.push_back(static_cast<char>(0xcd));
+                PutBig(bits, 2);
+            } else if (var <= 0xffffffffLL) {
+                out_.push_back(static_cast<char>(0xce));
+                PutBig(bits, 4);
+            } else {
+                out_.push_back(static_cast<char>(0xcf));
+                PutBig(bits, 8);
+            }
+        } else if (var >= -32) {
+            out_.push_back(static_cast<char>(var));
+        } else if (var >= -128) {
+            out_.push_back(static_cast<char>(0xd0));
+            PutBig(bits, 1);
+        } else if (var >= -32768) {
+            out_.push_back(static_cast<char>(0xd1));
+            PutBig(bits, 2);
+        } else if (var >= -2147483648LL) {
+            out_.push_back(static_cast<char>(0xd2));
+            PutBig(bits, 4);
+        } else {
+            out_.push_back(static_cast<char>(0xd3));
+            PutBig(bits, 8);
+        }
+    }
+
+    inline void Packer::PackValue(float var) {
+        uint32_t bits = 0;
+        std::memcpy(&bits, &var, sizeof(bits));
+        out_.push_back(static_cast<char>(0xca));
+        PutBig(bits, 4);
+    }
+
+    inline void Packer::PackValue(double var) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &var, sizeof(bits));
+        out_.push_back(static_cast<char>(0xcb));
+        PutBig(bits, 8);
+    }
+
+    inline void Packer::PackString(const char *str, size_t length) {
+        if (length < 32) {
+            out_.push_back(static_cast<char>(0xa0 | length));
+        } else if (length <= 0xff) {
+            out_.push_back(static_cast<char>(0xd9));
+            PutBig(length, 1);
+        } else if (length <= 0xffff) {
+            out_.push_back(static_cast<char>(0xda));
+            PutBig(length, 2);
+        } else {
+            out_.push_back(static_cast<char>(0xdb));
+            PutBig(length, 4);
+        }
+        out_.append(str, length);
+    }
+
+    inline void Packer::PackHeader(size_t count, unsigned char fix, unsigned char code16) {
+        if (count < 16) {
+            out_.push_back(static_cast<char>(fix | count));
+        } else if (count <= 0xffff) {
+            out_.push_back(static_cast<char>(code16));
+            PutBig(count, 2);
+        } else {
+            out_.push_back(static_cast<char>(code16 + 1));
+            PutBig(count, 4);
+        }
+    }
+
+    template <typename T, typename A>
+    inline void Packer::PackValue(const std::vector<T, A> &var) {
+        if (var.empty()) {
+            PackNil();
+            return;
+        }
+        PackHeader(var.size(), 0x90, 0xdc);
+        for (const T &item : var) {
+            PackValue(item);
+        }
+    }
+
+    template <typename M>
+    inline void Packer::PackMap(const M &var) {
+        if (var.empty()) {
+            PackNil();
+            return;
+        }
+        PackHeader(var.size(), 0x80, 0xde);
+        for (const auto &item : var) {
+            PackKey(item.first);
+            PackValue(item.second);
+        }
+    }
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type>
+    inline bool Packer::PackObject(const T &obj) {
+        size_t begin = sink_.Size();
+        sink_.Collect<Exact>(obj);
+        size_t end = sink_.Size();
+        if (end == begin) {
+            return false;
+        }
+        sink_.Sort(begin);
+        // the same key mapped twice keeps the last declaration, as in Writer::WriteFields
+        auto shadowed = [this, end](size_t i) {
+            return i + 1 < end && FieldSink::KeyCompare(sink_.Key(sink_.At(i)), sink_.At(i).key_length,
+                                                        sink_.Key(sink_.At(i + 1)), sink_.At(i + 1).key_length) == 0;
+        };
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i) {
+            count += shadowed(i) ? 0 : 1;
+        }
+        PackHeader(count, 0x80, 0xde);
+        for (size_t i = begin; i < end; ++i) {
+            if (shadowed(i)) {
+                continue;
+            }
+            FieldRef field = sink_.At(i);
+            PackString(sink_.Key(field), field.key_length);
+            field.ops->pack(*this, field.var);
+        }
+        sink_.Resize(begin);
+        return true;
+    }
+
+    template <typename T>
+    struct TablePacker {
+        Packer &packer;
+        const T &obj;
+
+        template <typename C, typename M>
+        void operator()(const Field<C, M> &field) const {
+            packer.PackValue(obj.*field.member);
+        }
+    };
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type>
+    inline bool Packer::PackObject(const T &obj) {
+        typedef FieldTable<T> Table;
+        const Table &table = Table::Get();
+        if (table.write_count == 0) {
+            return false;
+        }
+        PackHeader(table.write_count, 0x80, 0xde);
+        for (size_t k = 0; k < table.write_count; ++k) {
+            size_t i = table.write_order[k];
+            PackString(table.keys[i], table.lengths[i]);
+            table.Visit(i, TablePacker<T>{*this, obj});
+        }
+        return true;
+    }
+
+    inline bool Unpacker::ReadBig(size_t bytes, uint64_t &value) {
+        if (static_cast<size_t>(end_ - cur_) < bytes) {
+            return Fail();
+        }
+        value = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            value = (value << 8) | static_cast<unsigned char>(cur_[i]);
+        }
+        cur_ += bytes;
+        return true;
+    }
+
+    inline bool Unpacker::ReadHeader(unsigned char fix, unsigned char code16, size_t &count) {
+        unsigned char c = Peek();
+        if ((c & 0xf0) == fix) {
+            ++cur_;
+            count = c & 0x0f;
+            return true;
+        }
+        if (c != code16 && c != code16 + 1) {
+            return false;
+        }
+        ++cur_;
+        uint64_t value = 0;
+        if (!ReadBig(c == code16 ? 2 : 4, value)) {
+            return false;
+        }
+        count = static_cast<size_t>(value);
+        return true;
+    }
+
+    inline bool Unpacker::ReadString(const char *&str, size_t &length) {
+        unsigned char c = Peek();
+        uint64_t value = 0;
+        if (c >= 0xa0 && c <= 0xbf) {
+            ++cur_;
+            value = c & 0x1f;
+        } else if (c >= 0xd9 && c <= 0xdb) {
+            ++cur_;
+            if (!ReadBig(static_cast<size_t>(1) << (c - 0xd9), value)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        if (value > static_cast<uint64_t>(end_ - cur_)) {
+            return Fail();
+        }
+        str = cur_;
+        length = static_cast<size_t>(value);
+        cur_ += length;
+        return true;
+    }
+
+    inline bool Unpacker::ReadNumber(Number &number) {
+        unsigned char c = Peek();
+        uint64_t value = 0;
+        number.type = Number::Int;
+        if (c <= 0x7f || c >= 0xe0) {
+            // positive and negative fixint
+            ++cur_;
+            number.int_value = static_cast<signed char>(c);
+            return true;
+        }
+        if (c >= 0xca && c <= 0xd3) {
+            // float 32, float 64, uint 8-64, int 8-64
+            static const size_t kBytes[] = {4, 8, 1, 2, 4, 8, 1, 2, 4, 8};
+            ++cur_;
+            if (!ReadBig(kBytes[c - 0xca], value)) {
+                return false;
+            }
+        } else {
+            SkipValue();
+            return false;
+        }
+        if (c == 0xca) {
+            uint32_t bits = static_cast<uint32_t>(value);
+            float f = 0;
+            std::memcpy(&f, &bits, sizeof(f));
+            number.type = Number::Real;
+            number.real_value = f;
+        } else if (c == 0xcb) {
+            double d = 0;
+            std::memcpy(&d, &value, sizeof(d));
+            number.type = Number::Real;
+            number.real_value = d;
+        } else if (c <= 0xcf) {
+            if (value <= static_cast<uint64_t>(std::numeric_limits<long long>::max())) {
+                number.int_value = static_cast<long long>(value);
+            } else {
+                number.type = Number::UInt;
+                number.uint_value = value;
+            }
+        } else if (c == 0xd0) {
+            number.int_value = static_cast<int8_t>(value);
+        } else if (c == 0xd1) {
+            number.int_value = static_cast<int16_t>(value);
+        } else if (c == 0xd2) {
+            number.int_value = static_cast<int32_t>(value);
+        } else {
+            number.int_value = static_cast<long long>(value);
+        }
+        return true;
+    }
+
+    inline bool Unpacker::SkipValue() {
+        // iterative, a value only adds the count of its items to skip
+        uint64_t pending = 1;
+        while (pending > 0) {
+            --pending;
+            if (cur_ >= end_) {
+                return Fail();
+            }
+            unsigned char c = static_cast<unsigned char>(*cur_++);
+            uint64_t skip = 0;
+            uint64_t count = 0;
+            if (c <= 0x7f || c >= 0xe0 || c == 0xc0 || c == 0xc2 || c == 0xc3) {
+                continue;
+            } else if (c <= 0x8f) {
+                pending += 2 * (c & 0x0f);
+            } else if (c <= 0x9f) {
+                pending += c & 0x0f;
+            } else if (c <= 0xbf) {
+                skip = c & 0x1f;
+            } else if (c >= 0xc4 && c <= 0xc6) {
+                // bin 8-32
+                if (!ReadBig(static_cast<size_t>(1) << (c - 0xc4), skip)) {
+                    return false;
+                }
+            } else if (c >= 0xc7 && c <= 0xc9) {
+                // ext 8-32, a type byte follows the length
+                if (!ReadBig(static_cast<size_t>(1) << (c - 0xc7), skip)) {
+                    return false;
+                }
+                skip += 1;
+            } else if (c >= 0xca && c <= 0xd3) {
+                static const size_t kBytes[] = {4, 8, 1, 2, 4, 8, 1, 2, 4, 8};
+                skip = kBytes[c - 0xca];
+            } else if (c >= 0xd4 && c <= 0xd8) {
+                // fixext 1-16 with their type byte
+                skip = (static_cast<uint64_t>(1) << (c - 0xd4)) + 1;
+            } else if (c >= 0xd9 && c <= 0xdb) {
+                if (!ReadBig(static_cast<size_t>(1) << (c - 0xd9), skip)) {
+                    return false;
+                }
+            } else if (c == 0xdc || c == 0xdd) {
+                if (!ReadBig(c == 0xdc ? 2 : 4, count)) {
+                    return false;
+                }
+                pending += count;
+            } else if (c == 0xde || c == 0xdf) {
+                if (!ReadBig(c == 0xde ? 2 : 4, count)) {
+                    return false;
+                }
+                pending += 2 * count;
+            } else {
+                // 0xc1 is never used
+                return Fail();
+            }
+            if (skip > static_cast<uint64_t>(end_ - cur_)) {
+                return Fail();
+            }
+            cur_ += skip;
+        }
+        return true;
+    }
+
+    inline bool Unpacker::UnpackValue(int &var) {
+        Number number;
+        if (ReadNumber(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    inline bool Unpacker::UnpackValue(long &var) {
+        Number number;
+        if (ReadNumber(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    inline bool Unpacker::UnpackValue(bool &var) {
+        unsigned char c = Peek();
+        if (c == 0xc2 || c == 0xc3) {
+            ++cur_;
+            var = c == 0xc3;
+        } else {
+            SkipValue();
+        }
+        return true;
+    }
+
+    inline bool Unpacker::UnpackValue(double &var) {
+        Number number;
+        if (ReadNumber(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    inline bool Unpacker::UnpackValue(float &var) {
+        Number number;
+        if (ReadNumber(number)) {
+            _assign_number(number, var);
+        }
+        return true;
+    }
+
+    template <typename A>
+    inline bool Unpacker::UnpackValue(BasicString<A> &var) {
+        const char *str = nullptr;
+        size_t length = 0;
+        if (ReadString(str, length)) {
+            var.assign(str, length);
+        } else {
+            SkipValue();
+        }
+        return true;
+    }
+
+    template <typename T, typename A>
+    inline bool Unpacker::UnpackElement(std::vector<T, A> &var) {
+        var.emplace_back();
+        return UnpackValue(var.back());
+    }
+
+    template <typename A>
+    inline bool Unpacker::UnpackElement(std::vector<bool, A> &var) {
+        bool item = false;
+        bool ok = UnpackValue(item);
+        var.push_back(item);
+        return ok;
+    }
+
+    template <typename T, typename A>
+    inline bool Unpacker::UnpackValue(std::vector<T, A> &var) {
+        size_t count = 0;
+        if (!ReadHeader(0x90, 0xdc, count)) {
+            return SkipValue(), true;
+        }
+        // every element takes a byte at least, a forged count can not reserve more than the input
+        if (++depth_ > kMaxDepth || count > static_cast<size_t>(end_ - cur_)) {
+            return Fail();
+        }
         var.clear();
-        auto mems = dc.getMemberNames();
-        for (auto &mem : mems) {
-            T item;
-            if (_unmarshal_for_spl_(item, dc[mem])) {
-                var.template emplace(atoi(mem.c_str()), item);
+        var.reserve(count);
+        bool ok = true;
+        for (size_t i = 0; i < count; ++i) {
+            if (ok && !UnpackElement(var)) {
+                // one element failed, the whole vector is dropped
+                ok = false;
+                var = std::vector<T, A>(var.get_allocator());
+            } else if (!ok) {
+                SkipValue();
+            }
+            if (failed_) {
+                return false;
+            }
+        }
+        --depth_;
+        return true;
+    }
+
+    template <typename K, typename B>
+    inline typename B::Value *Unpacker::ReadNumberKey(B &builder, std::true_type) {
+        Number number;
+        if (!ReadNumber(number) || number.type != Number::Int) {
+            return nullptr;
+        }
+        return builder.Emplace(static_cast<K>(number.int_value));
+    }
+
+    template <typename K, typename B>
+    inline typename B::Value *Unpacker::ReadMapKey(B &builder) {
+        const char *key = nullptr;
+        size_t length = 0;
+        if (ReadString(key, length)) {
+            return _emplace_key<K>(builder, key, length, std::is_integral<K>());
+        }
+        return failed_ ? nullptr : ReadNumberKey<K>(builder, std::is_integral<K>());
+    }
+
+    template <typename M>
+    inline bool Unpacker::UnpackMap(M &var) {
+        typedef typename std::remove_const<typename M::value_type::first_type>::type K;
+        size_t count = 0;
+        if (!ReadHeader(0x80, 0xde, count)) {
+            return SkipValue(), true;
+        }
+        // every member takes two bytes at least
+        if (++depth_ > kMaxDepth || count > static_cast<size_t>(end_ - cur_) / 2) {
+            return Fail();
+        }
+        MapBuilder<M> builder(var);
+        builder.Begin(count);
+        for (size_t n = 0; n < count && !failed_; ++n) {
+            auto *value = ReadMapKey<K>(builder);
+            if (value == nullptr) {
+                SkipValue();
+            } else if (!UnpackValue(*value)) {
+                builder.Drop();
+            }
+        }
+        // the members before a truncation are kept
+        builder.End();
+        if (failed_) {
+            return false;
+        }
+        --depth_;
+        return true;
+    }
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::helper,int>::type>
+    inline void Unpacker::UnpackObject(T &obj, size_t count) {
+        if (++depth_ > kMaxDepth) {
+            Fail();
+            return;
+        }
+        size_t begin = sink_.Size();
+        sink_.Collect<Exact>(obj);
+        size_t slot_begin = slots_.size();
+        size_t mask = _index_frame(sink_, slots_, begin);
+        for (size_t n = 0; n < count && !failed_; ++n) {
+            const char *key = nullptr;
+            size_t key_length = 0;
+            size_t i = kNoField;
+            if (ReadString(key, key_length)) {
+                i = _find_field(sink_, slots_, slot_begin, mask, key, key_length);
+            } else {
+                SkipValue();
+            }
+            if (i == kNoField) {
+                SkipValue();
+            }
+            // every member mapped to the key gets the value
+            const char *value = cur_;
+            for (; i != kNoField && !failed_; i = sink_.At(i).next) {
+                cur_ = value;
+                sink_.At(i).ops->unpack(*this, sink_.At(i).var);
+            }
+        }
+        slots_.resize(slot_begin);
+        sink_.Resize(begin);
+        --depth_;
+    }
+
+    template <typename T>
+    struct TableUnpacker {
+        Unpacker &unpacker;
+        T &obj;
+
+        template <typename C, typename M>
+        void operator()(const Field<C, M> &field) const {
+            unpacker.UnpackValue(obj.*field.member);
+        }
+    };
+
+    template <bool Exact, typename T, typename std::enable_if<Mapping_check<T>::table,int>::type>
+    inline void Unpacker::UnpackObject(T &obj, size_t count) {
+        typedef FieldTable<T> Table;
+        if (++depth_ > kMaxDepth) {
+            Fail();
+            return;
+        }
+        const Table &table = Table::Get();
+        for (size_t n = 0; n < count && !failed_; ++n) {
+            const char *key = nullptr;
+            size_t key_length = 0;
+            size_t first = 0;
+            size_t last = 0;
+            if (ReadString(key, key_length)) {
+                table.Find(key, key_length, first, last);
+            } else {
+                SkipValue();
             }
+            if (first == last) {
+                SkipValue();
+            }
+            // every member mapped to the key gets the value
+            const char *value = cur_;
+            for (size_t k = first; k < last && !failed_; ++k) {
+                cur_ = value;
+                table.Visit(table.order[k], TableUnpacker<T>{*this, obj});
+            }
+        }
+        --depth_;
+    }
+
+    template <typename T, typename std::enable_if<Mapping_check<T>::exist,int>::type>
+    inline bool Unpacker::UnpackValue(T &obj) {
+        size_t count = 0;
+        if (!ReadHeader(0x80, 0xde, count)) {
+            SkipValue();
+            return false;
+        }
+        // an empty map is an object without members, as an empty JSON object
+        if (count == 0) {
+            return false;
         }
+        UnpackObject(obj, count);
+        return !failed_;
     }
 }
 
-#endif //AUTO_JSON_H
+#endif //AUTO_JSON_H
\ No newline at end of file
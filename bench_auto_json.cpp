@@ -0,0 +1,472 @@
+//
+// Benchmarks of AutoJson::Marshal/Unmarshal, scaled along element count, nesting depth, string length
+// and map key type. Each benchmark reports MB/s, objects/s, allocations per operation and the peak RSS.
+//
+// --baseline_update=FILE records the results, --baseline_check=FILE fails the run (exit code 2) when a
+// benchmark is slower than its baseline by more than --baseline_tolerance (0.15 by default) or allocates
+// more per operation. Times depend on the machine: record the baseline where the check runs.
+//
+
+#include <sys/resource.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <unordered_map>
+#include "benchmark/benchmark.h"
+#include "auto_json.h"
+
+// Every allocation of the process goes through these, benchmarks read the count around their loop.
+// Not inlined, GCC would otherwise pair the inlined malloc/free with the callers' new/delete and warn.
+static std::atomic<size_t> g_allocations(0);
+
+__attribute__((noinline)) void *operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size != 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t /*size*/) noexcept {
+    std::free(p);
+}
+
+struct InnerMsg : public AutoJsonHelper {
+    int id = 0;
+    std::string name;
+    double avg_double = 0;
+    std::vector<std::string> array_string;
+    std::vector<int> array_int;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(id, "innermsg_id");
+        AUTO_JSON_MAPPING(name, "innermsg_name");
+        AUTO_JSON_MAPPING(avg_double, "innermsg_avg_double");
+        AUTO_JSON_MAPPING(array_string, "innermsg_array_string");
+        AUTO_JSON_MAPPING(array_int, "innermsg_array_int");
+    }
+};
+
+struct JsonMsg : public AutoJsonHelper {
+    int id = 0;
+    std::string name;
+    double avg_double = 0;
+    std::vector<std::string> array_string;
+    std::vector<int> array_int;
+    std::vector<InnerMsg> array_innermsg;
+    std::map<std::string, std::string> map_string_string;
+    std::map<std::string, InnerMsg> map_string_innermsg;
+    std::map<int, int> map_int_int;
+    std::map<int, InnerMsg> map_int_innermsg;
+    InnerMsg innermsg;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(id, "id");
+        AUTO_JSON_MAPPING(name, "name");
+        AUTO_JSON_MAPPING(avg_double, "avg_double");
+        AUTO_JSON_MAPPING(array_string, "array_string");
+        AUTO_JSON_MAPPING(array_int, "array_int");
+        AUTO_JSON_MAPPING(array_innermsg, "array_innermsg");
+        AUTO_JSON_MAPPING(map_string_string, "map_string_string");
+        AUTO_JSON_MAPPING(map_string_innermsg, "map_string_innermsg");
+        AUTO_JSON_MAPPING(map_int_int, "map_int_int");
+        AUTO_JSON_MAPPING(map_int_innermsg, "map_int_innermsg");
+        AUTO_JSON_MAPPING(innermsg, "innermsg");
+    }
+};
+
+struct NodeMsg : public AutoJsonHelper {
+    int id = 0;
+    std::vector<NodeMsg> children;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(id, "id");
+        AUTO_JSON_MAPPING(children, "children");
+    }
+};
+
+struct StringMsg : public AutoJsonHelper {
+    std::string text;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(text, "text");
+    }
+};
+
+template <typename M>
+struct MapMsg : public AutoJsonHelper {
+    M values;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(values, "values");
+    }
+};
+
+typedef std::map<std::string, int> StringMap;
+typedef std::map<int, int> IntMap;
+typedef std::unordered_map<std::string, int> HashStringMap;
+typedef std::vector<std::pair<int, int>> FlatIntMap;
+
+static InnerMsg MakeInner(int i) {
+    InnerMsg inner;
+    inner.id = i;
+    inner.name = "inner_" + std::to_string(i);
+    inner.avg_double = i * 0.25 + 0.1;
+    inner.array_string = {"a", "bc", "def"};
+    inner.array_int = {i, i * 7, -i};
+    return inner;
+}
+
+/**
+ * JsonMsg whose arrays and maps hold 'count' elements each
+ */
+static JsonMsg MakeJsonMsg(int count) {
+    JsonMsg msg;
+    msg.id = 1001;
+    msg.name = "json_msg";
+    msg.avg_double = 3.14159265358979;
+    msg.innermsg = MakeInner(0);
+    for (int i = 0; i < count; ++i) {
+        std::string key = "key_" + std::to_string(i);
+        msg.array_string.push_back(key);
+        msg.array_int.push_back(i * 31);
+        msg.array_innermsg.push_back(MakeInner(i));
+        msg.map_string_string[key] = "value";
+        msg.map_string_innermsg[key] = MakeInner(i);
+        msg.map_int_int[i * 13 - 100] = i;
+        msg.map_int_innermsg[i] = MakeInner(i);
+    }
+    return msg;
+}
+
+/**
+ * Chain of 'depth' nested objects, each one holding the next in a one-element array
+ */
+static NodeMsg MakeNode(int depth) {
+    NodeMsg root;
+    NodeMsg *node = &root;
+    for (int i = 1; i < depth; ++i) {
+        node->children.resize(1);
+        node = &node->children[0];
+        node->id = i;
+    }
+    return root;
+}
+
+/**
+ * Mostly plain text with a quote and a newline every 64 bytes, so both the scanners and the escapes run
+ */
+static StringMsg MakeString(int length) {
+    StringMsg msg;
+    for (int i = 0; i < length; ++i) {
+        msg.text.push_back(i % 64 == 31 ? '"' : i % 64 == 63 ? '\n' : static_cast<char>('a' + i % 26));
+    }
+    return msg;
+}
+
+static void FillMap(StringMap &values, int count) {
+    for (int i = 0; i < count; ++i) {
+        values["key_" + std::to_string(i)] = i;
+    }
+}
+
+static void FillMap(IntMap &values, int count) {
+    for (int i = 0; i < count; ++i) {
+        values[i * 13 - 100] = i;
+    }
+}
+
+static void FillMap(HashStringMap &values, int count) {
+    for (int i = 0; i < count; ++i) {
+        values["key_" + std::to_string(i)] = i;
+    }
+}
+
+static void FillMap(FlatIntMap &values, int count) {
+    for (int i = 0; i < count; ++i) {
+        values.emplace_back(i * 13 - 100, i);
+    }
+}
+
+/**
+ * Peak resident set size of the process in KB
+ */
+static double PeakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024.0;
+#else
+    return static_cast<double>(usage.ru_maxrss);
+#endif
+}
+
+static void Report(benchmark::State &state, size_t json_size, size_t allocations) {
+    double iterations = static_cast<double>(state.iterations());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * json_size));
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs_per_op"] = iterations > 0 ? allocations / iterations : 0;
+    state.counters["peak_rss_kb"] = PeakRssKb();
+}
+
+template <typename T>
+static void RunMarshal(benchmark::State &state, const T &obj) {
+    std::string json;
+    // the first call sizes the output and the per-thread scratch, as on a warm hot path
+    AutoJson::Marshal(json, obj);
+    size_t allocations = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        AutoJson::Marshal(json, obj);
+        benchmark::DoNotOptimize(json.data());
+    }
+    Report(state, json.size(), g_allocations.load(std::memory_order_relaxed) - allocations);
+}
+
+template <typename T>
+static void RunUnmarshal(benchmark::State &state, const T &obj) {
+    std::string json;
+    AutoJson::Marshal(json, obj);
+    {
+        T result;
+        AutoJson::Unmarshal(json, result);
+        std::string round_trip;
+        AutoJson::Marshal(round_trip, result);
+        if (round_trip != json) {
+            state.SkipWithError("unmarshal does not round-trip");
+            return;
+        }
+    }
+    size_t allocations = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        T result;
+        AutoJson::Unmarshal(json, result);
+        benchmark::DoNotOptimize(&result);
+    }
+    Report(state, json.size(), g_allocations.load(std::memory_order_relaxed) - allocations);
+}
+
+static void BM_MarshalJsonMsg(benchmark::State &state) {
+    RunMarshal(state, MakeJsonMsg(static_cast<int>(state.range(0))));
+}
+
+static void BM_UnmarshalJsonMsg(benchmark::State &state) {
+    RunUnmarshal(state, MakeJsonMsg(static_cast<int>(state.range(0))));
+}
+
+static void BM_MarshalInnerMsg(benchmark::State &state) {
+    RunMarshal(state, MakeInner(42));
+}
+
+static void BM_UnmarshalInnerMsg(benchmark::State &state) {
+    RunUnmarshal(state, MakeInner(42));
+}
+
+static void BM_MarshalDepth(benchmark::State &state) {
+    RunMarshal(state, MakeNode(static_cast<int>(state.range(0))));
+}
+
+static void BM_UnmarshalDepth(benchmark::State &state) {
+    RunUnmarshal(state, MakeNode(static_cast<int>(state.range(0))));
+}
+
+static void BM_MarshalString(benchmark::State &state) {
+    RunMarshal(state, MakeString(static_cast<int>(state.range(0))));
+}
+
+static void BM_UnmarshalString(benchmark::State &state) {
+    RunUnmarshal(state, MakeString(static_cast<int>(state.range(0))));
+}
+
+template <typename M>
+static void BM_MarshalMap(benchmark::State &state) {
+    MapMsg<M> msg;
+    FillMap(msg.values, static_cast<int>(state.range(0)));
+    RunMarshal(state, msg);
+}
+
+template <typename M>
+static void BM_UnmarshalMap(benchmark::State &state) {
+    MapMsg<M> msg;
+    FillMap(msg.values, static_cast<int>(state.range(0)));
+    RunUnmarshal(state, msg);
+}
+
+BENCHMARK(BM_MarshalInnerMsg);
+BENCHMARK(BM_UnmarshalInnerMsg);
+BENCHMARK(BM_MarshalJsonMsg)->RangeMultiplier(8)->Range(1, 512);
+BENCHMARK(BM_UnmarshalJsonMsg)->RangeMultiplier(8)->Range(1, 512);
+// every level is an object and an array, the parser accepts 1000 nested values
+BENCHMARK(BM_MarshalDepth)->RangeMultiplier(8)->Range(1, 256);
+BENCHMARK(BM_UnmarshalDepth)->RangeMultiplier(8)->Range(1, 256);
+BENCHMARK(BM_MarshalString)->RangeMultiplier(16)->Range(16, 1 << 16);
+BENCHMARK(BM_UnmarshalString)->RangeMultiplier(16)->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_MarshalMap, StringMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_UnmarshalMap, StringMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_MarshalMap, IntMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_UnmarshalMap, IntMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_MarshalMap, HashStringMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_UnmarshalMap, HashStringMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_MarshalMap, FlatIntMap)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_UnmarshalMap, FlatIntMap)->Arg(16)->Arg(4096);
+
+/**
+ * Result of one benchmark kept in the baseline file
+ */
+struct BaselineEntry : public AutoJsonHelper {
+    double ns_per_op = 0;       //!< CPU time
+    double allocs_per_op = 0;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(ns_per_op, "ns_per_op");
+        AUTO_JSON_MAPPING(allocs_per_op, "allocs_per_op");
+    }
+};
+
+struct Baseline : public AutoJsonHelper {
+    std::map<std::string, BaselineEntry> benchmarks;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(benchmarks, "benchmarks");
+    }
+};
+
+/**
+ * Console output that also keeps the fastest repetition of each benchmark
+ */
+class BaselineReporter : public benchmark::ConsoleReporter {
+public:
+    void ReportRuns(const std::vector<Run> &runs) override {
+        for (const Run &run : runs) {
+            if (run.error_occurred || run.run_type != Run::RT_Iteration || run.iterations == 0) {
+                continue;
+            }
+            BaselineEntry entry;
+            entry.ns_per_op = run.cpu_accumulated_time / run.iterations * 1e9;
+            auto allocs = run.counters.find("allocs_per_op");
+            entry.allocs_per_op = allocs != run.counters.end() ? allocs->second.value : 0;
+            auto result = results_.benchmarks.emplace(run.benchmark_name(), entry);
+            if (!result.second && entry.ns_per_op < result.first->second.ns_per_op) {
+                result.first->second = entry;
+            }
+        }
+        ConsoleReporter::ReportRuns(runs);
+    }
+
+    const Baseline &Results() const { return results_; }
+
+private:
+    Baseline results_;
+};
+
+/**
+ * Remove '--name=value' from the arguments
+ * @return true if it was given
+ */
+static bool TakeFlag(int &argc, char **argv, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], prefix.c_str(), prefix.size()) == 0) {
+            value = argv[i] + prefix.size();
+            for (int k = i; k + 1 < argc; ++k) {
+                argv[k] = argv[k + 1];
+            }
+            --argc;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Compare the results with the baseline, benchmarks missing on either side are skipped
+ * @return Number of regressions
+ */
+static int CheckBaseline(const Baseline &baseline, const Baseline &results, double tolerance) {
+    int regressions = 0;
+    for (const auto &it : baseline.benchmarks) {
+        auto found = results.benchmarks.find(it.first);
+        if (found == results.benchmarks.end()) {
+            continue;
+        }
+        const BaselineEntry &base = it.second;
+        const BaselineEntry &now = found->second;
+        if (now.ns_per_op > base.ns_per_op * (1 + tolerance)) {
+            std::fprintf(stderr, "REGRESSION %s: %.1f ns/op, baseline %.1f ns/op (%+.1f%%)\n", it.first.c_str(),
+                         now.ns_per_op, base.ns_per_op, (now.ns_per_op / base.ns_per_op - 1) * 100);
+            ++regressions;
+        }
+        // allocation counts are deterministic, any increase is a regression
+        if (now.allocs_per_op > base.allocs_per_op + 0.5) {
+            std::fprintf(stderr, "REGRESSION %s: %.1f allocs/op, baseline %.1f allocs/op\n", it.first.c_str(),
+                         now.allocs_per_op, base.allocs_per_op);
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+/**
+ * Write one benchmark per line so that baseline updates diff well
+ */
+static bool WriteBaseline(const std::string &path, const Baseline &results) {
+    std::ofstream out(path);
+    out << "{\"benchmarks\":{\n";
+    std::string entry;
+    for (auto it = results.benchmarks.begin(); it != results.benchmarks.end(); ++it) {
+        AutoJson::Marshal(entry, it->second);
+        out << "\"" << it->first << "\":" << entry << (std::next(it) != results.benchmarks.end() ? ",\n" : "\n");
+    }
+    out << "}}\n";
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char **argv) {
+    std::string check_path;
+    std::string update_path;
+    std::string tolerance = "0.15";
+    bool check = TakeFlag(argc, argv, "baseline_check", check_path);
+    bool update = TakeFlag(argc, argv, "baseline_update", update_path);
+    TakeFlag(argc, argv, "baseline_tolerance", tolerance);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    Baseline baseline;
+    if (check) {
+        std::ifstream in(check_path);
+        std::stringstream text;
+        text << in.rdbuf();
+        AutoJson::Unmarshal(text.str(), baseline);
+        if (!in || baseline.benchmarks.empty()) {
+            std::fprintf(stderr, "can not read baseline %s\n", check_path.c_str());
+            return 1;
+        }
+    }
+
+    BaselineReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    if (update && !WriteBaseline(update_path, reporter.Results())) {
+        std::fprintf(stderr, "can not write baseline %s\n", update_path.c_str());
+        return 1;
+    }
+    if (check) {
+        int regressions = CheckBaseline(baseline, reporter.Results(), std::atof(tolerance.c_str()));
+        if (regressions != 0) {
+            std::fprintf(stderr, "%d regression(s) against %s\n", regressions, check_path.c_str());
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -2,6 +2,14 @@
 // Created by DerrickHsu on 2024/3/25.
 //
 
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 #include "cpp_free_mock.h"
@@ -71,6 +79,112 @@ struct JsonMsg : public AutoJsonHelper {
     }
 };
 
+// 与InnerMsg映射相同, 使用编译期字段表声明
+struct TableInnerMsg {
+    int id = 0;
+    std::string name;
+    double avg_double = 0;
+    std::vector<std::string> array_string;
+    std::vector<int> array_int;
+
+    AUTO_JSON_FIELDS(TableInnerMsg,
+                     AUTO_JSON_FIELD(id, "innermsg_id"),
+                     AUTO_JSON_FIELD(name, "innermsg_name"),
+                     AUTO_JSON_FIELD(avg_double, "innermsg_avg_double"),
+                     AUTO_JSON_FIELD(array_string, "innermsg_array_string"),
+                     AUTO_JSON_FIELD(array_int, "innermsg_array_int"))
+};
+
+// 字段表结构体与AutoJsonHelper结构体互相嵌套
+struct TableMsg {
+    int id = 0;
+    std::string name;
+    std::vector<TableInnerMsg> array_innermsg;
+    std::map<int, TableInnerMsg> map_int_innermsg;
+    InnerMsg innermsg;
+    TableInnerMsg table_innermsg;
+
+    AUTO_JSON_FIELDS(TableMsg,
+                     AUTO_JSON_FIELD(name, "name"),
+                     AUTO_JSON_FIELD(id, "id"),
+                     AUTO_JSON_FIELD(array_innermsg, "array_innermsg"),
+                     AUTO_JSON_FIELD(map_int_innermsg, "map_int_innermsg"),
+                     AUTO_JSON_FIELD(innermsg, "innermsg"),
+                     AUTO_JSON_FIELD(table_innermsg, "table_innermsg"))
+};
+
+struct HelperTableMsg : public AutoJsonHelper {
+    int id = 0;
+    TableMsg table_msg;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(id, "id");
+        AUTO_JSON_MAPPING(table_msg, "table_msg");
+    }
+};
+
+// 静态绑定SetJsonMapping的结构体, 映射与InnerMsg相同
+struct StaticInnerMsg : public AutoJsonStaticHelper<StaticInnerMsg> {
+    int id = 0;
+    std::string name;
+    double avg_double = 0;
+    std::vector<std::string> array_string;
+    std::vector<int> array_int;
+
+    void SetJsonMapping() {
+        AUTO_JSON_MAPPING(id, "innermsg_id");
+        AUTO_JSON_MAPPING(name, "innermsg_name");
+        AUTO_JSON_MAPPING(avg_double, "innermsg_avg_double");
+        AUTO_JSON_MAPPING(array_string, "innermsg_array_string");
+        AUTO_JSON_MAPPING(array_int, "innermsg_array_int");
+    }
+};
+
+struct StaticMsg : public AutoJsonStaticHelper<StaticMsg> {
+    std::vector<StaticInnerMsg> array_innermsg;
+    std::map<int, StaticInnerMsg> map_int_innermsg;
+    StaticInnerMsg innermsg;
+
+    void SetJsonMapping() {
+        AUTO_JSON_MAPPING(array_innermsg, "array_innermsg");
+        AUTO_JSON_MAPPING(map_int_innermsg, "map_int_innermsg");
+        AUTO_JSON_MAPPING(innermsg, "innermsg");
+    }
+};
+
+// 通过基类引用marshal时仍使用派生类的映射
+struct DerivedInnerMsg : public InnerMsg {
+    int extra = 0;
+
+    void SetJsonMapping() override {
+        InnerMsg::SetJsonMapping();
+        AUTO_JSON_MAPPING(extra, "extra");
+    }
+};
+
+// 不侵入类型定义的映射声明, 结构体保持原有大小
+struct PlainInnerMsg {
+    int id;
+    std::string name;
+    std::vector<int> array_int;
+};
+
+AUTO_JSON_TYPE_FIELDS(PlainInnerMsg,
+                      AUTO_JSON_FIELD(id, "innermsg_id"),
+                      AUTO_JSON_FIELD(name, "innermsg_name"),
+                      AUTO_JSON_FIELD(array_int, "innermsg_array_int"))
+
+struct PlainMsg {
+    long id;
+    std::vector<PlainInnerMsg> array_innermsg;
+    std::map<int, PlainInnerMsg> map_int_innermsg;
+};
+
+AUTO_JSON_TYPE_FIELDS(PlainMsg,
+                      AUTO_JSON_FIELD(id, "id"),
+                      AUTO_JSON_FIELD(array_innermsg, "array_innermsg"),
+                      AUTO_JSON_FIELD(map_int_innermsg, "map_int_innermsg"))
+
 class AutoJsonTest : public ::testing::Test {
 public:
     virtual void SetUp() {
@@ -93,6 +207,22 @@ public:
  * Case3: 结构体中部分字段无需marshal
  * Case4: 空SetJsonMapping函数
  * Case5: 未继承AutoJsonHelper调用AutoJson::Marshal
+ * Case6: 流式marshal与Json::Value文档输出逐字节一致
+ * Case7: marshal到Json::Value文档
+ * Case8: 编译期字段表声明的结构体marshal
+ * Case9: 多线程同时marshal同一个const对象
+ * Case10: 非侵入式映射声明的结构体marshal
+ * Case11: 静态绑定SetJsonMapping的结构体marshal/unmarshal
+ * Case12: 复用Codec连续marshal/unmarshal, GetString与Json::FastWriter输出一致
+ * Case13: 批量marshal为json数组或多个json串, 多线程结果一致
+ * Case14: 按行写出NDJSON到流/文件描述符
+ * Case15: 追加marshal到已有string/vector<char>/定长缓冲区, 保留原内容与容量
+ * Case16: 浮点数按最短可往返表示marshal, float不带多余位数
+ * Case17: 长字符串按块扫描转义与引号, 各扫描实现结果一致
+ * Case18: 按字段掩码只marshal选中的字段
+ * Case19: 增量marshal, 只重新编码标记过的对象与容器字段
+ * Case20: 按同样的映射marshal为MessagePack
+ * Case21: 通过可替换的文档后端marshal/unmarshal, 映射类型无需修改
  * -----Unmarshal-----
  * Case1: 正常格式的unmarshal
  * Case2: json中字段全部为默认值
@@ -101,6 +231,22 @@ public:
  * Case5: 空SetJsonMapping函数
  * Case6: 未继承AutoJsonHelper调用AutoJson::Unmarshal
  * Case7: json串中key对应的value类型非结构体中的类型
+ * Case8: 流式unmarshal与Json::Value文档unmarshal结果一致
+ * Case9: 直接unmarshal已解析的Json::Value文档
+ * Case10: 编译期字段表声明的结构体unmarshal
+ * Case11: 字段较多且json稀疏时按key分发, 包含重复key映射
+ * Case12: 非侵入式映射声明的结构体unmarshal
+ * Case13: 批量unmarshal json数组或多个json串, 多线程结果一致
+ * Case14: 按行读取NDJSON, 跳过空行与超长行
+ * Case15: 从原始缓冲区/string_view/文件直接unmarshal, 不越过缓冲区末尾
+ * Case16: std::pmr容器与字符串从调用方提供的arena分配
+ * Case17: unordered_map与有序vector<pair>作为map, 整数key原地解析
+ * Case18: 复用对象反复unmarshal, 保留容器容量, 结果与新对象一致
+ * Case19: 懒解析视图只解码访问到的字段
+ * Case20: 按字段掩码只unmarshal选中的字段
+ * Case21: unmarshal MessagePack, 类型不匹配与截断的输入
+ * Case22: 对象与各类map中的重复key均以最后一个值为准
+ * Case23: 非法输入返回false, 出错前的字段保留新值, 按行读取时跳过非法行
  * =========================
  */
 
@@ -145,7 +291,7 @@ TEST_F(AutoJsonTest, TestMarshal_case1) {
 
     std::string result;
     AutoJson::Marshal(result, json_msg);
-    std::string right_json = R"({"array_innermsg":[{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}],"array_int":[1,2,3],"array_string":["msg_string_1","msg_string_2","msg_string_3"],"avg_double":6.474825986812029,"id":1001,"innermsg":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},"map_int_innermsg":{"1":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},"2":{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},"3":{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}},"map_int_int":{"1":11,"2":22,"3":33},"map_int_string":{"1":"value_1","2":"value_2","3":"value_3"},"map_string_innermsg":{"key_1":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},"key_2":{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},"key_3":{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}},"map_string_int":{"key_1":1,"key_2":2,"key_3":3},"map_string_string":{"key_1":"value_1","key_2":"value_2","key_3":"value_3"},"name":"msg"})";
+    std::string right_json = R"({"array_innermsg":[{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.1415926535897962,"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}],"array_int":[1,2,3],"array_string":["msg_string_1","msg_string_2","msg_string_3"],"avg_double":6.4748259868120295,"id":1001,"innermsg":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.1415926535897962,"innermsg_id":1,"innermsg_name":"inner_1"},"map_int_innermsg":{"1":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.1415926535897962,"innermsg_id":1,"innermsg_name":"inner_1"},"2":{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},"3":{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}},"map_int_int":{"1":11,"2":22,"3":33},"map_int_string":{"1":"value_1","2":"value_2","3":"value_3"},"map_string_innermsg":{"key_1":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.1415926535897962,"innermsg_id":1,"innermsg_name":"inner_1"},"key_2":{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},"key_3":{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}},"map_string_int":{"key_1":1,"key_2":2,"key_3":3},"map_string_string":{"key_1":"value_1","key_2":"value_2","key_3":"value_3"},"name":"msg"})";
 
     EXPECT_EQ(result, right_json);
 };
@@ -222,6 +368,906 @@ TEST_F(AutoJsonTest, TestMarshal_case5) {
     EXPECT_EQ(result, "");
 }
 
+// case6: 流式marshal与Json::Value文档输出逐字节一致
+TEST_F(AutoJsonTest, TestMarshal_case6) {
+    struct Case6Inner : public AutoJsonHelper {
+        std::string text;
+        std::vector<int> empty_array;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(text, "text");
+            AUTO_JSON_MAPPING(empty_array, "empty_array");
+        }
+    };
+    struct Case6Empty : public AutoJsonHelper {
+        void SetJsonMapping() override {}
+    };
+    struct Case6Struct : public AutoJsonHelper {
+        long id;
+        bool flag;
+        float ratio;
+        std::vector<double> doubles;
+        std::string text;
+        std::map<int, std::string> map_int_string;
+        std::map<long, Case6Inner> map_long_inner;
+        std::vector<Case6Empty> array_empty;
+        std::vector<std::vector<std::string>> array_array;
+        Case6Inner inner;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(text, "text");
+            AUTO_JSON_MAPPING(id, "id");
+            AUTO_JSON_MAPPING(flag, "flag");
+            AUTO_JSON_MAPPING(ratio, "ratio");
+            AUTO_JSON_MAPPING(doubles, "doubles");
+            AUTO_JSON_MAPPING(map_int_string, "map_int_string");
+            AUTO_JSON_MAPPING(map_long_inner, "map_long_inner");
+            AUTO_JSON_MAPPING(array_empty, "array_empty");
+            AUTO_JSON_MAPPING(array_array, "array_array");
+            AUTO_JSON_MAPPING(inner, std::string("in") + "ner");
+            AUTO_JSON_MAPPING(id, "id");
+        }
+    };
+
+    Case6Struct msg;
+    msg.id = -9223372036854775807L - 1;
+    msg.flag = true;
+    msg.ratio = 0.1f;
+    msg.doubles = std::vector<double>{0, -2.5, 1e300, 1.0 / 3, std::numeric_limits<double>::infinity()};
+    msg.text = std::string("q\"b\\s/\b\f\n\r\t\x01\x7f h\xc3\xa9 \xf0\x9f\x98\x80 bad\xff e\0nd", 32);
+    msg.map_int_string = std::map<int, std::string>{{-1, "a"}, {2, "b"}, {10, "c"}, {9, "d"}};
+    msg.map_long_inner[3].text = "inner_3";
+    msg.map_long_inner[20].text = "inner_20";
+    msg.array_empty.resize(2);
+    msg.array_array = std::vector<std::vector<std::string>>{{"a", "b"}, {}, {"c"}};
+    msg.inner.text = "\xe4\xb8\xad\xe6\x96\x87";
+
+    msg.Clear();
+    msg.SetMethod(AutoJsonMethod::Marshal);
+    msg.SetJsonMapping();
+    std::string right_json = msg.GetString();
+
+    std::string result;
+    AutoJson::Marshal(result, msg);
+    EXPECT_EQ(result, right_json);
+}
+
+// case7: marshal到Json::Value文档
+TEST_F(AutoJsonTest, TestMarshal_case7) {
+    JsonMsg json_msg;
+    json_msg.id = 1001;
+    json_msg.name = "msg";
+    json_msg.avg_double = pai;
+    json_msg.array_innermsg.resize(2);
+    json_msg.array_innermsg[0].reset();
+    json_msg.array_innermsg[0].id = 1;
+    json_msg.array_innermsg[1].reset();
+    json_msg.array_innermsg[1].array_int = std::vector<int>{1, 2};
+    json_msg.map_int_innermsg[10].reset();
+    json_msg.map_int_innermsg[10].name = "inner_10";
+    json_msg.innermsg.reset();
+    json_msg.innermsg.array_string = std::vector<std::string>{"a"};
+
+    Json::Value root(123);
+    AutoJson::Marshal(root, json_msg);
+    std::string right_json;
+    AutoJson::Marshal(right_json, json_msg);
+    Json::FastWriter writer;
+    std::string result = writer.write(root);
+    result.pop_back();
+    EXPECT_EQ(result, right_json);
+    ASSERT_TRUE(root["array_innermsg"].isArray());
+    EXPECT_EQ(root["array_innermsg"].size(), 2);
+    EXPECT_EQ(root["map_int_innermsg"]["10"]["innermsg_name"].asString(), "inner_10");
+
+    // 嵌套结构体不保留文档副本
+    EXPECT_TRUE(json_msg.GetDocument().isNull());
+    EXPECT_TRUE(json_msg.innermsg.GetDocument().isNull());
+    EXPECT_TRUE(json_msg.array_innermsg[0].GetDocument().isNull());
+}
+
+// case8: 编译期字段表声明的结构体marshal
+TEST_F(AutoJsonTest, TestMarshal_case8) {
+    TableInnerMsg table_inner;
+    table_inner.id = 1;
+    table_inner.name = "inner_1";
+    table_inner.avg_double = pai;
+    table_inner.array_string = std::vector<std::string>{"a", "b"};
+    table_inner.array_int = std::vector<int>{1, 2};
+    InnerMsg inner;
+    inner.id = 1;
+    inner.name = "inner_1";
+    inner.avg_double = pai;
+    inner.array_string = std::vector<std::string>{"a", "b"};
+    inner.array_int = std::vector<int>{1, 2};
+
+    std::string result;
+    std::string right_json;
+    AutoJson::Marshal(result, table_inner);
+    AutoJson::Marshal(right_json, inner);
+    EXPECT_EQ(result, right_json);
+
+    HelperTableMsg msg;
+    msg.id = 7;
+    msg.table_msg.id = 1001;
+    msg.table_msg.name = "msg";
+    msg.table_msg.array_innermsg.resize(2);
+    msg.table_msg.array_innermsg[1].id = 2;
+    msg.table_msg.map_int_innermsg[10].name = "inner_10";
+    msg.table_msg.innermsg.reset();
+    msg.table_msg.innermsg.id = 3;
+    msg.table_msg.table_innermsg = table_inner;
+    AutoJson::Marshal(result, msg);
+    EXPECT_EQ(result, R"({"id":7,"table_msg":{"array_innermsg":[{"innermsg_array_int":null,"innermsg_array_string":null,"innermsg_avg_double":0.0,"innermsg_id":0,"innermsg_name":""},{"innermsg_array_int":null,"innermsg_array_string":null,"innermsg_avg_double":0.0,"innermsg_id":2,"innermsg_name":""}],"id":1001,"innermsg":{"innermsg_array_int":null,"innermsg_array_string":null,"innermsg_avg_double":0.0,"innermsg_id":3,"innermsg_name":""},"map_int_innermsg":{"10":{"innermsg_array_int":null,"innermsg_array_string":null,"innermsg_avg_double":0.0,"innermsg_id":0,"innermsg_name":"inner_10"}},"name":"msg","table_innermsg":)" + right_json + "}}");
+
+    // Json::Value文档输出一致
+    Json::Value root;
+    AutoJson::Marshal(root, msg);
+    Json::FastWriter writer;
+    right_json = writer.write(root);
+    right_json.pop_back();
+    EXPECT_EQ(result, right_json);
+    AutoJson::Marshal(root, msg.table_msg);
+    EXPECT_EQ(root["table_innermsg"]["innermsg_name"].asString(), "inner_1");
+}
+
+// case9: 多线程同时marshal同一个const对象
+TEST_F(AutoJsonTest, TestMarshal_case9) {
+    JsonMsg json_msg;
+    json_msg.id = 1001;
+    json_msg.name = "msg";
+    json_msg.avg_double = pai;
+    json_msg.array_innermsg.resize(2);
+    json_msg.array_innermsg[0].reset();
+    json_msg.array_innermsg[0].id = 1;
+    json_msg.array_innermsg[1].reset();
+    json_msg.array_innermsg[1].name = "inner_2";
+    json_msg.map_string_innermsg["key_1"].reset();
+    json_msg.innermsg.reset();
+    json_msg.innermsg.array_int = std::vector<int>{1, 2};
+    const JsonMsg &shared = json_msg;
+
+    std::string right_json;
+    AutoJson::Marshal(right_json, shared);
+    std::vector<int> mismatches(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < mismatches.size(); ++i) {
+        threads.emplace_back([&shared, &right_json, &mismatches, i]() {
+            Json::FastWriter writer;
+            for (int j = 0; j < 200; ++j) {
+                std::string result;
+                AutoJson::Marshal(result, shared);
+                Json::Value root;
+                AutoJson::Marshal(root, shared);
+                std::string document = writer.write(root);
+                document.pop_back();
+                mismatches[i] += (result != right_json) + (document != right_json);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (int mismatch : mismatches) {
+        EXPECT_EQ(mismatch, 0);
+    }
+    // 对象本身未被修改
+    EXPECT_TRUE(shared.GetDocument().isNull());
+    EXPECT_TRUE(shared.innermsg.GetDocument().isNull());
+}
+
+// case10: 非侵入式映射声明的结构体marshal
+TEST_F(AutoJsonTest, TestMarshal_case10) {
+    struct NaturalInnerMsg {
+        int id;
+        std::string name;
+        std::vector<int> array_int;
+    };
+    EXPECT_EQ(sizeof(PlainInnerMsg), sizeof(NaturalInnerMsg));
+    EXPECT_FALSE(std::is_polymorphic<PlainInnerMsg>::value);
+    EXPECT_FALSE(std::is_polymorphic<TableInnerMsg>::value);
+
+    PlainMsg msg{};
+    msg.id = 4294967296L;
+    msg.array_innermsg.resize(2);
+    msg.array_innermsg[0].id = 1;
+    msg.array_innermsg[0].name = "inner_1";
+    msg.array_innermsg[1].id = 2;
+    msg.array_innermsg[1].array_int = std::vector<int>{1, 2};
+    msg.map_int_innermsg[3].id = 3;
+
+    std::string result;
+    AutoJson::Marshal(result, msg);
+    std::string right_json = R"({"array_innermsg":[{"innermsg_array_int":null,"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_array_int":[1,2],"innermsg_id":2,"innermsg_name":""}],"id":4294967296,"map_int_innermsg":{"3":{"innermsg_array_int":null,"innermsg_id":3,"innermsg_name":""}}})";
+    EXPECT_EQ(result, right_json);
+
+    Json::Value root;
+    AutoJson::Marshal(root, msg);
+    Json::FastWriter writer;
+    result = writer.write(root);
+    result.pop_back();
+    EXPECT_EQ(result, right_json);
+}
+
+// case11: 静态绑定SetJsonMapping的结构体marshal/unmarshal
+TEST_F(AutoJsonTest, TestMarshal_case11) {
+    EXPECT_FALSE(std::is_polymorphic<StaticInnerMsg>::value);
+
+    StaticMsg msg;
+    msg.array_innermsg.resize(2);
+    msg.array_innermsg[0].id = 1;
+    msg.array_innermsg[1].array_int = std::vector<int>{1, 2};
+    msg.map_int_innermsg[3].name = "inner_3";
+    msg.innermsg.avg_double = pai;
+    InnerMsg inner;
+    inner.reset();
+    inner.avg_double = pai;
+
+    std::string result;
+    AutoJson::Marshal(result, msg.innermsg);
+    std::string right_json;
+    AutoJson::Marshal(right_json, inner);
+    EXPECT_EQ(result, right_json);
+
+    AutoJson::Marshal(result, msg);
+    Json::Value root;
+    AutoJson::Marshal(root, msg);
+    Json::FastWriter writer;
+    right_json = writer.write(root);
+    right_json.pop_back();
+    EXPECT_EQ(result, right_json);
+
+    StaticMsg copy;
+    AutoJson::Unmarshal(result, copy);
+    ASSERT_EQ(copy.array_innermsg.size(), 2);
+    EXPECT_EQ(copy.array_innermsg[0].id, 1);
+    ASSERT_EQ(copy.array_innermsg[1].array_int.size(), 2);
+    EXPECT_EQ(copy.map_int_innermsg[3].name, "inner_3");
+    EXPECT_EQ(copy.innermsg.avg_double, pai);
+
+    // 原有SetMethod/GetString用法
+    AutoJson::Marshal(right_json, msg.innermsg);
+    msg.innermsg.SetMethod(AutoJsonMethod::Marshal);
+    msg.innermsg.SetJsonMapping();
+    EXPECT_EQ(msg.innermsg.GetString(), right_json);
+
+    // 根对象通过基类引用传入时仍调用派生类的SetJsonMapping
+    DerivedInnerMsg derived;
+    derived.reset();
+    derived.extra = 5;
+    const InnerMsg &base = derived;
+    AutoJson::Marshal(result, base);
+    EXPECT_NE(result.find(R"("extra":5)"), std::string::npos);
+    AutoJson::Marshal(root, base);
+    EXPECT_EQ(root["extra"].asInt(), 5);
+}
+
+// case12: 复用Codec连续marshal/unmarshal, GetString与Json::FastWriter输出一致
+TEST_F(AutoJsonTest, TestMarshal_case12) {
+    AutoJson::Codec codec;
+    std::string json_string;
+    for (int i = 0; i < 3; ++i) {
+        JsonMsg json_msg;
+        json_msg.id = i;
+        json_msg.name = "msg_" + std::to_string(i);
+        json_msg.avg_double = pai;
+        json_msg.array_innermsg.resize(i + 1);
+        for (auto &inner : json_msg.array_innermsg) {
+            inner.reset();
+            inner.id = i;
+        }
+        json_msg.map_int_int[i] = i * 11;
+        json_msg.innermsg.reset();
+
+        std::string right_json;
+        AutoJson::Marshal(right_json, json_msg);
+        EXPECT_EQ(codec.Marshal(json_msg), right_json);
+        codec.Marshal(json_string, json_msg);
+        EXPECT_EQ(json_string, right_json);
+
+        JsonMsg result;
+        result.innermsg.reset();
+        codec.Unmarshal(json_string, result);
+        EXPECT_EQ(result.id, i);
+        EXPECT_EQ(result.name, json_msg.name);
+        EXPECT_EQ(result.array_innermsg.size(), i + 1);
+        EXPECT_EQ(result.map_int_int[i], i * 11);
+    }
+
+    Json::Value root;
+    root["int"] = Json::Int64(-4294967296L);
+    root["uint"] = Json::UInt64(18446744073709551615UL);
+    root["double"] = 1.5;
+    root["string"] = "a\"\\\n\x01\xe4\xb8\xad/";
+    root["bool"] = false;
+    root["null"] = Json::Value();
+    root["empty_array"] = Json::Value(Json::arrayValue);
+    root["empty_object"] = Json::Value(Json::objectValue);
+    root["array"].append(1);
+    root["array"].append(Json::Value(Json::objectValue));
+    root["object"]["b"] = 2;
+    root["object"]["a"]["c"] = "d";
+    InnerMsg inner;
+    inner.SetDocument(root);
+    Json::FastWriter writer;
+    std::string right_json = writer.write(root);
+    right_json.pop_back();
+    EXPECT_EQ(inner.GetString(), right_json);
+    inner.GetString(json_string);
+    EXPECT_EQ(json_string, right_json);
+    inner.SetDocument(Json::Value(Json::objectValue));
+    EXPECT_EQ(inner.GetString(), "");
+}
+
+// case13: 批量marshal为json数组或多个json串, 多线程结果一致
+TEST_F(AutoJsonTest, TestMarshal_case13) {
+    std::vector<InnerMsg> objs(10);
+    std::string right_json = "[";
+    for (size_t i = 0; i < objs.size(); ++i) {
+        objs[i].reset();
+        objs[i].id = static_cast<int>(i);
+        objs[i].name = "inner_" + std::to_string(i);
+        std::string json_string;
+        AutoJson::Marshal(json_string, objs[i]);
+        right_json += (i == 0 ? "" : ",") + json_string;
+    }
+    right_json += "]";
+
+    for (size_t parallelism : {1, 3, 16, 0}) {
+        std::string json_array;
+        AutoJson::MarshalMany(json_array, objs, parallelism);
+        EXPECT_EQ(json_array, right_json) << parallelism;
+
+        std::vector<std::string> json_strings;
+        AutoJson::MarshalMany(json_strings, objs, parallelism);
+        ASSERT_EQ(json_strings.size(), objs.size());
+        std::string json_string;
+        AutoJson::Marshal(json_string, objs[7]);
+        EXPECT_EQ(json_strings[7], json_string);
+    }
+
+    // 复用调用方的线程池
+    AutoJson::ThreadPool pool(3);
+    EXPECT_EQ(pool.Parallelism(), 3);
+    for (int round = 0; round < 3; ++round) {
+        std::string json_array;
+        AutoJson::MarshalMany(json_array, objs, pool);
+        EXPECT_EQ(json_array, right_json);
+        std::vector<std::string> json_strings;
+        AutoJson::MarshalMany(json_strings, objs, pool);
+        ASSERT_EQ(json_strings.size(), objs.size());
+        std::string json_string;
+        AutoJson::Marshal(json_string, objs[7]);
+        EXPECT_EQ(json_strings[7], json_string);
+    }
+
+    std::string json_array = "unchanged";
+    AutoJson::MarshalMany(json_array, std::vector<InnerMsg>{}, 4);
+    EXPECT_EQ(json_array, "[]");
+    AutoJson::MarshalMany(json_array, std::vector<InnerMsg>{}, pool);
+    EXPECT_EQ(json_array, "[]");
+}
+
+// case14: 按行写出NDJSON到流/文件描述符
+TEST_F(AutoJsonTest, TestMarshal_case14) {
+    std::vector<TableInnerMsg> objs(3);
+    objs[0].id = 1;
+    objs[1].name = "line\n2";
+    objs[2].array_int = std::vector<int>{3};
+    std::string right_lines;
+    for (const auto &obj : objs) {
+        std::string json_string;
+        AutoJson::Marshal(json_string, obj);
+        right_lines += json_string + "\n";
+    }
+
+    struct EmptyMsg : public AutoJsonHelper {
+        int id = 0;
+
+        void SetJsonMapping() override {
+        }
+    };
+
+    std::ostringstream out;
+    {
+        AutoJson::LineWriter writer(out, 16);
+        for (const auto &obj : objs) {
+            writer.Write(obj);
+        }
+        // 没有映射字段的对象写为{}
+        writer.Write(EmptyMsg());
+    }
+    EXPECT_EQ(out.str(), right_lines + "{}\n");
+
+    std::FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    AutoJson::LineWriter writer(fileno(file));
+    for (const auto &obj : objs) {
+        writer.Write(obj);
+    }
+    writer.Flush();
+    EXPECT_FALSE(writer.Failed());
+    std::rewind(file);
+    std::string content(right_lines.size() + 1, '\0');
+    content.resize(std::fread(&content[0], 1, content.size(), file));
+    EXPECT_EQ(content, right_lines);
+    std::fclose(file);
+}
+
+// case15: 追加marshal到已有string/vector<char>/定长缓冲区, 保留原内容与容量
+TEST_F(AutoJsonTest, TestMarshal_case15) {
+    TableInnerMsg first;
+    first.id = 1;
+    first.name = "first";
+    TableInnerMsg second;
+    second.array_int = std::vector<int>{2, 3};
+    std::string first_json;
+    std::string second_json;
+    AutoJson::Marshal(first_json, first);
+    AutoJson::Marshal(second_json, second);
+
+    std::string body = "[";
+    body.reserve(1024);
+    const char *data = body.data();
+    AutoJson::MarshalAppend(body, first);
+    body.push_back(',');
+    AutoJson::MarshalAppend(body, second);
+    body.push_back(']');
+    EXPECT_EQ(body, "[" + first_json + "," + second_json + "]");
+    // 容量足够时不重新分配
+    EXPECT_EQ(body.data(), data);
+
+    // 没有映射字段的对象不追加任何内容
+    struct EmptyMsg : public AutoJsonHelper {
+        int id = 0;
+
+        void SetJsonMapping() override {
+        }
+    };
+    std::string unchanged = "prefix";
+    AutoJson::MarshalAppend(unchanged, EmptyMsg());
+    EXPECT_EQ(unchanged, "prefix");
+
+    std::vector<char> chars{'x'};
+    AutoJson::MarshalAppend(chars, first);
+    AutoJson::MarshalAppend(chars, second);
+    EXPECT_EQ(std::string(chars.begin(), chars.end()), "x" + first_json + second_json);
+
+    char buf[256];
+    std::memset(buf, '#', sizeof(buf));
+    size_t length = AutoJson::MarshalTo(buf, sizeof(buf), first);
+    ASSERT_EQ(length, first_json.size());
+    EXPECT_EQ(std::string(buf, length), first_json);
+    EXPECT_EQ(buf[length], '#');
+    // 缓冲区不足时返回所需长度且不写入
+    std::memset(buf, '#', sizeof(buf));
+    EXPECT_EQ(AutoJson::MarshalTo(buf, length - 1, first), length);
+    EXPECT_EQ(buf[0], '#');
+
+    AutoJson::Codec codec;
+    std::string codec_body = "{\"items\":";
+    codec.MarshalAppend(codec_body, second);
+    EXPECT_EQ(codec_body, "{\"items\":" + second_json);
+
+    // 学习到的大小提示之后, 连续追加时缓冲区增长次数有限
+    std::string many;
+    size_t growth = 0;
+    for (int i = 0; i < 1000; ++i) {
+        size_t capacity = many.capacity();
+        AutoJson::MarshalAppend(many, first);
+        growth += many.capacity() != capacity;
+    }
+    EXPECT_EQ(many.size(), first_json.size() * 1000);
+    EXPECT_LE(growth, 20);
+}
+
+// case16: 浮点数按最短可往返表示marshal, float不带多余位数
+TEST_F(AutoJsonTest, TestMarshal_case16) {
+    struct NumberMsg : public AutoJsonHelper {
+        double value = 0;
+        float ratio = 0;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(value, "value");
+            AUTO_JSON_MAPPING(ratio, "ratio");
+        }
+    };
+    // 经Json::Value文档输出
+    auto document_string = [](NumberMsg &msg) {
+        msg.Clear();
+        msg.SetMethod(AutoJsonMethod::Marshal);
+        msg.SetJsonMapping();
+        return msg.GetString();
+    };
+
+    std::vector<std::pair<double, std::string>> doubles{
+        {0.1, "0.1"}, {1.0 / 3, "0.3333333333333333"}, {pai, "3.1415926535897962"}, {100000, "100000.0"},
+        {-0.0, "-0.0"}, {123.456, "123.456"}, {0.0001, "0.0001"}, {1.5e-5, "1.5e-05"}, {1e16, "10000000000000000.0"},
+        {1e17, "1e+17"}, {1e300, "1e+300"}, {5e-324, "5e-324"},
+        {std::numeric_limits<double>::max(), "1.7976931348623157e+308"}};
+    for (const auto &item : doubles) {
+        NumberMsg msg;
+        msg.value = item.first;
+        std::string json_string;
+        AutoJson::Marshal(json_string, msg);
+        EXPECT_EQ(json_string, R"({"ratio":0.0,"value":)" + item.second + "}");
+        EXPECT_EQ(document_string(msg), json_string);
+    }
+
+    NumberMsg msg;
+    msg.ratio = 0.1f;
+    msg.value = 2.5;
+    std::string json_string;
+    AutoJson::Marshal(json_string, msg);
+    EXPECT_EQ(json_string, R"({"ratio":0.1,"value":2.5})");
+    // 文档路径输出相同的字节
+    EXPECT_EQ(document_string(msg), json_string);
+
+    // 随机位模式的double/float往返后逐位相同
+    std::mt19937_64 random(20240325);
+    for (int i = 0; i < 10000; ++i) {
+        uint64_t bits = random();
+        uint32_t float_bits = static_cast<uint32_t>(bits >> 32);
+        NumberMsg source;
+        std::memcpy(&source.value, &bits, sizeof(bits));
+        std::memcpy(&source.ratio, &float_bits, sizeof(float_bits));
+        if (!std::isfinite(source.value) || !std::isfinite(source.ratio)) {
+            continue;
+        }
+        AutoJson::Marshal(json_string, source);
+        NumberMsg result;
+        AutoJson::Unmarshal(json_string, result);
+        ASSERT_EQ(std::memcmp(&result.value, &source.value, sizeof(double)), 0) << json_string;
+        ASSERT_EQ(std::memcmp(&result.ratio, &source.ratio, sizeof(float)), 0) << json_string;
+    }
+}
+
+// case17: 长字符串按块扫描转义与引号, 各扫描实现结果一致
+TEST_F(AutoJsonTest, TestMarshal_case17) {
+    typedef _autojson::StringScan Scan;
+    std::vector<std::pair<Scan::Scanner, Scan::Scanner>> scanners{{Scan::Get().escape, Scan::Get().quote}};
+#ifdef AUTO_JSON_HAS_SSE2
+    scanners.emplace_back(&Scan::EscapeSse2, &Scan::QuoteSse2);
+#endif
+    const char specials[] = {'"', '\\', '\n', '\x01', '\x1f', '\x80', '\xff'};
+    for (size_t length = 0; length <= 80; ++length) {
+        for (size_t pos = 0; pos <= length; ++pos) {
+            for (char special : specials) {
+                // 特殊字节之前是不需要转义的字符, 包括边界值0x20与0x7f
+                std::string text(length, 'a');
+                for (size_t i = 0; i < pos; ++i) {
+                    text[i] = i % 3 == 0 ? ' ' : (i % 3 == 1 ? '\x7f' : 'a');
+                }
+                if (pos < length) {
+                    text[pos] = special;
+                }
+                const char *begin = text.data();
+                const char *end = begin + length;
+                bool quote = special == '"' || special == '\\';
+                for (const auto &scanner : scanners) {
+                    ASSERT_EQ(scanner.first(begin, end), Scan::EscapeScalar(begin, end));
+                    ASSERT_EQ(scanner.first(begin, end) - begin, static_cast<ptrdiff_t>(pos));
+                    ASSERT_EQ(scanner.second(begin, end), Scan::QuoteScalar(begin, end));
+                    ASSERT_EQ(scanner.second(begin, end) - begin, static_cast<ptrdiff_t>(quote ? pos : length));
+                }
+            }
+        }
+    }
+
+    struct TextMsg : public AutoJsonHelper {
+        std::string text;
+        std::vector<std::string> lines;
+        std::map<std::string, std::string> fields;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(text, "text");
+            AUTO_JSON_MAPPING(lines, "lines");
+            AUTO_JSON_MAPPING(fields, "fields");
+        }
+    };
+
+    TextMsg msg;
+    std::string block = "plain text of a long log message, ";
+    for (int i = 0; i < 64; ++i) {
+        msg.text += block + std::string(1, specials[i % sizeof(specials)]);
+        msg.text += "\xe4\xb8\xad";
+        msg.lines.push_back(block.substr(0, i % block.size()) + "\"quoted\"");
+    }
+    msg.fields[block + "\\key\t"] = block + "\r\n";
+    std::string json_string;
+    AutoJson::Marshal(json_string, msg);
+    Json::Value root;
+    ASSERT_TRUE(Json::Reader().parse(json_string, root));
+    EXPECT_EQ(json_string + "\n", Json::FastWriter().write(root));
+
+    TextMsg result;
+    AutoJson::Unmarshal(json_string, result);
+    EXPECT_EQ(result.lines, msg.lines);
+    EXPECT_EQ(result.fields, msg.fields);
+    // 非法UTF-8字节被替换为U+FFFD, 与jsoncpp解析结果一致
+    EXPECT_EQ(result.text, root["text"].asString());
+}
+
+// case18: 按字段掩码只marshal选中的字段
+TEST_F(AutoJsonTest, TestMarshal_case18) {
+    JsonMsg msg;
+    msg.id = 1001;
+    msg.name = "name";
+    msg.avg_double = pai;
+    msg.innermsg.reset();
+    msg.innermsg.id = 7;
+    msg.innermsg.name = "inner";
+    for (int i = 0; i < 2; ++i) {
+        InnerMsg inner;
+        inner.reset();
+        inner.id = i;
+        inner.name = "inner_" + std::to_string(i);
+        msg.array_innermsg.push_back(inner);
+        msg.map_int_innermsg[i] = inner;
+    }
+
+    AutoJson::FieldMask mask{"id", "innermsg.innermsg_name", "array_innermsg.innermsg_id",
+                             "map_int_innermsg.innermsg_name", "not_mapped.innermsg_id"};
+    std::string json_string;
+    AutoJson::Marshal(json_string, msg, mask);
+    EXPECT_EQ(json_string, R"({"array_innermsg":[{"innermsg_id":0},{"innermsg_id":1}],"id":1001,)"
+                           R"("innermsg":{"innermsg_name":"inner"},)"
+                           R"("map_int_innermsg":{"0":{"innermsg_name":"inner_0"},"1":{"innermsg_name":"inner_1"}}})");
+
+    // 选中整个字段时其下的路径不再生效
+    mask.Add("innermsg");
+    mask.Add("innermsg.innermsg_id");
+    AutoJson::Marshal(json_string, msg, mask);
+    std::string inner_json;
+    AutoJson::Marshal(inner_json, msg.innermsg);
+    EXPECT_NE(json_string.find(R"("innermsg":)" + inner_json), std::string::npos);
+
+    // 空掩码不选中任何字段
+    AutoJson::Marshal(json_string, msg, AutoJson::FieldMask());
+    EXPECT_EQ(json_string, "{}");
+    AutoJson::Marshal(json_string, msg, AutoJson::FieldMask{"innermsg.not_mapped"});
+    EXPECT_EQ(json_string, R"({"innermsg":{}})");
+
+    // 编译期字段表声明的类型
+    TableMsg table;
+    table.id = 9;
+    table.name = "table";
+    table.table_innermsg.id = 11;
+    table.table_innermsg.name = "table_inner";
+    AutoJson::Marshal(json_string, table, AutoJson::FieldMask{"name", "table_innermsg.innermsg_id"});
+    EXPECT_EQ(json_string, R"({"name":"table","table_innermsg":{"innermsg_id":11}})");
+}
+
+// case19: 增量marshal, 只重新编码标记过的对象与容器字段
+TEST_F(AutoJsonTest, TestMarshal_case19) {
+    JsonMsg msg;
+    msg.id = 1;
+    msg.name = "snapshot";
+    msg.avg_double = pai;
+    msg.innermsg.reset();
+    msg.innermsg.name = "inner";
+    for (int i = 0; i < 5; ++i) {
+        InnerMsg inner;
+        inner.reset();
+        inner.id = i;
+        msg.array_innermsg.push_back(inner);
+        msg.map_int_int[i] = i;
+    }
+    AutoJson::FragmentCache<JsonMsg> cache(msg);
+    auto expect_marshal = [&msg](const std::string &json_string) {
+        std::string right;
+        AutoJson::Marshal(right, msg);
+        EXPECT_EQ(json_string, right);
+    };
+    expect_marshal(cache.Marshal());
+
+    // 标量与字符串每次都重新编码
+    msg.id = 2;
+    msg.name = "changed";
+    expect_marshal(cache.Marshal());
+
+    // 单个元素变化需标记, 数组末尾追加与删除元素无需标记
+    msg.array_innermsg[3].name = "element";
+    cache.Touch(msg.array_innermsg, 3);
+    msg.array_innermsg.push_back(msg.array_innermsg[0]);
+    expect_marshal(cache.Marshal());
+    msg.array_innermsg.resize(2);
+    expect_marshal(cache.Marshal());
+    msg.array_innermsg.clear();
+    expect_marshal(cache.Marshal());
+    msg.array_innermsg.resize(3);
+    expect_marshal(cache.Marshal());
+    for (int i = 0; i < 3; ++i) {
+        msg.array_innermsg[i].id = 100 + i;
+    }
+    cache.Touch(msg.array_innermsg);
+    expect_marshal(cache.Marshal());
+    // 删除首个元素后其余元素前移, 不会拼接按下标缓存的旧编码
+    msg.array_innermsg.erase(msg.array_innermsg.begin());
+    expect_marshal(cache.Marshal());
+    // 同一次调用中既删除又追加, 大小不变, 需要标记
+    msg.array_innermsg.erase(msg.array_innermsg.begin());
+    msg.array_innermsg.push_back(msg.array_innermsg[0]);
+    cache.Touch(msg.array_innermsg);
+    expect_marshal(cache.Marshal());
+
+    // map大小变化时重新编码
+    msg.map_int_int[10] = 10;
+    expect_marshal(cache.Marshal());
+
+    // map的值变化无需标记
+    msg.map_int_int[0] = 100;
+    expect_marshal(cache.Marshal());
+
+    // 未标记的嵌套对象保留缓存的编码, 调试构建中触发断言
+    msg.innermsg.id = 42;
+#ifdef NDEBUG
+    std::string stale = cache.Marshal();
+    EXPECT_EQ(stale.find(R"("innermsg_id":42)"), std::string::npos);
+#else
+    EXPECT_DEATH(cache.Marshal(), "without Touch");
+#endif
+    cache.Touch(msg.innermsg);
+    msg.map_int_int[10] = 11;
+    cache.Touch(msg.map_int_int);
+    std::string json_string;
+    cache.Marshal(json_string);
+    expect_marshal(json_string);
+
+    // 整体赋值后全部重新编码
+    JsonMsg other;
+    other.id = 3;
+    other.innermsg.reset();
+    msg = other;
+    cache.TouchAll();
+    expect_marshal(cache.Marshal());
+
+    // 编译期字段表声明的类型
+    TableMsg table;
+    table.id = 9;
+    table.array_innermsg.resize(2);
+    AutoJson::FragmentCache<TableMsg> table_cache(table);
+    std::string table_right;
+    AutoJson::Marshal(table_right, table);
+    EXPECT_EQ(table_cache.Marshal(), table_right);
+    table.array_innermsg[1].id = 5;
+    table_cache.Touch(table.array_innermsg, 1);
+    table.table_innermsg.name = "table";
+    table_cache.Touch(table.table_innermsg);
+    AutoJson::Marshal(table_right, table);
+    EXPECT_EQ(table_cache.Marshal(), table_right);
+}
+
+// case20: 按同样的映射marshal为MessagePack
+TEST_F(AutoJsonTest, TestMarshal_case20) {
+    InnerMsg inner;
+    inner.reset();
+    inner.id = 1;
+    inner.name = "a";
+    inner.avg_double = 0.5;
+    inner.array_int = {1, 300};
+    std::string packed;
+    AutoJson::MarshalMsgPack(packed, inner);
+    std::string right = "\x85";
+    right += "\xb2" "innermsg_array_int" "\x92\x01\xcd\x01\x2c";
+    right += "\xb5" "innermsg_array_string" "\xc0";
+    right += "\xb3" "innermsg_avg_double" "\xcb\x3f\xe0" + std::string(6, '\0');
+    right += "\xab" "innermsg_id" "\x01";
+    right += "\xad" "innermsg_name" "\xa1" "a";
+    EXPECT_EQ(packed, right);
+
+    // 与JSON往返结果一致, 比JSON更紧凑
+    JsonMsg msg;
+    msg.id = -100000;
+    msg.name = std::string(300, 'n');
+    msg.avg_double = pai;
+    msg.array_string = {"x", "y"};
+    msg.array_int = {0, -1, -33, 128, 70000, 2147483647};
+    msg.innermsg = inner;
+    for (int i = 0; i < 20; ++i) {
+        msg.array_innermsg.push_back(inner);
+        msg.map_string_string["k" + std::to_string(i)] = "v";
+        msg.map_int_int[i * 1000 - 5000] = i;
+        msg.map_int_innermsg[i] = inner;
+    }
+    msg.map_string_int["int"] = 7;
+    msg.map_string_innermsg["inner"] = inner;
+    msg.map_int_string[-1] = "neg";
+    AutoJson::MarshalMsgPack(packed, msg);
+    std::string json_string;
+    AutoJson::Marshal(json_string, msg);
+    EXPECT_LT(packed.size(), json_string.size());
+    JsonMsg result;
+    AutoJson::UnmarshalMsgPack(packed, result);
+    std::string result_json;
+    AutoJson::Marshal(result_json, result);
+    EXPECT_EQ(result_json, json_string);
+
+    // 编译期字段表声明的类型, 没有映射字段时输出为空
+    TableMsg table;
+    table.id = 9;
+    table.array_innermsg.resize(3);
+    table.table_innermsg.name = "table";
+    AutoJson::MarshalMsgPack(packed, table);
+    TableMsg table_result;
+    AutoJson::UnmarshalMsgPack(packed.data(), packed.size(), table_result);
+    AutoJson::Marshal(json_string, table);
+    AutoJson::Marshal(result_json, table_result);
+    EXPECT_EQ(result_json, json_string);
+    struct EmptyMsg : public AutoJsonHelper {
+        void SetJsonMapping() override {}
+    };
+    AutoJson::MarshalMsgPack(packed, EmptyMsg());
+    EXPECT_TRUE(packed.empty());
+}
+
+// case21: 通过可替换的文档后端marshal/unmarshal, 映射类型无需修改
+struct TextBackend {
+    struct Document {
+        std::string text;
+    };
+    static int parsed;
+
+    static bool Parse(const char *data, size_t length, Document &doc) {
+        ++parsed;
+        doc.text.assign(data, length);
+        return length == 0 || data[0] == '{';
+    }
+
+    static void Write(const Document &doc, std::string &json) {
+        json.append(doc.text);
+    }
+};
+int TextBackend::parsed = 0;
+
+TEST_F(AutoJsonTest, TestMarshal_case21) {
+    JsonMsg msg;
+    msg.id = 7;
+    msg.name = "doc";
+    msg.array_int = {1, 2};
+    msg.innermsg.reset();
+    msg.innermsg.name = "inner";
+    msg.map_int_string[3] = "three";
+    std::string right_json;
+    AutoJson::Marshal(right_json, msg);
+
+    TextBackend::Document doc;
+    EXPECT_TRUE(AutoJson::MarshalDocument<TextBackend>(doc, msg));
+    EXPECT_EQ(doc.text, right_json);
+    EXPECT_EQ(TextBackend::parsed, 1);
+    JsonMsg result;
+    AutoJson::UnmarshalDocument<TextBackend>(doc, result);
+    std::string result_json;
+    AutoJson::Marshal(result_json, result);
+    EXPECT_EQ(result_json, right_json);
+
+    // 编译期字段表声明的类型; 没有映射字段时不调用后端, 得到空文档
+    TableMsg table;
+    table.id = 3;
+    table.table_innermsg.name = "t";
+    EXPECT_TRUE(AutoJson::MarshalDocument<TextBackend>(doc, table));
+    AutoJson::Marshal(right_json, table);
+    EXPECT_EQ(doc.text, right_json);
+    struct EmptyMsg : public AutoJsonHelper {
+        void SetJsonMapping() override {}
+    };
+    EXPECT_TRUE(AutoJson::MarshalDocument<TextBackend>(doc, EmptyMsg()));
+    EXPECT_TRUE(doc.text.empty());
+    EXPECT_EQ(TextBackend::parsed, 2);
+
+    // jsoncpp后端与直接构建Json::Value文档结果一致
+    Json::Value root;
+    EXPECT_TRUE(AutoJson::MarshalDocument<AutoJson::JsoncppBackend>(root, msg));
+    Json::Value right_root;
+    AutoJson::Marshal(right_root, msg);
+    EXPECT_EQ(root, right_root);
+    JsonMsg root_result;
+    AutoJson::UnmarshalDocument<AutoJson::JsoncppBackend>(root, root_result);
+    AutoJson::Marshal(result_json, root_result);
+    AutoJson::Marshal(right_json, msg);
+    EXPECT_EQ(result_json, right_json);
+}
+
 // case1: 正常格式的unmarshal
 TEST_F(AutoJsonTest, TestUnmarshal_case1) {
     std::string json_string = R"({"array_innermsg":[{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}],"array_int":[1,2,3],"array_string":["msg_string_1","msg_string_2","msg_string_3"],"avg_double":6.474825986812029,"id":1001,"innermsg":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},"map_int_innermsg":{"1":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},"2":{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},"3":{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}},"map_int_int":{"1":11,"2":22,"3":33},"map_int_string":{"1":"value_1","2":"value_2","3":"value_3"},"map_string_innermsg":{"key_1":{"innermsg_array_int":[10001,10002,10003,10004],"innermsg_array_string":["inner_string_1","inner_string_2","inner_string_3"],"innermsg_avg_double":3.141592653589796,"innermsg_id":1,"innermsg_name":"inner_1"},"key_2":{"innermsg_array_int":[20001,20002,20003,20004],"innermsg_array_string":["inner_string_4","inner_string_5","inner_string_6"],"innermsg_avg_double":4.252603764690807,"innermsg_id":2,"innermsg_name":"inner_2"},"key_3":{"innermsg_array_int":[30001,30002,30003,30004],"innermsg_array_string":["inner_string_7","inner_string_8","inner_string_9"],"innermsg_avg_double":5.363714875701919,"innermsg_id":3,"innermsg_name":"inner_3"}},"map_string_int":{"key_1":1,"key_2":2,"key_3":3},"map_string_string":{"key_1":"value_1","key_2":"value_2","key_3":"value_3"},"name":"msg"})";
@@ -568,4 +1614,993 @@ TEST_F(AutoJsonTest, TestUnmarshal_case7) {
     EXPECT_EQ(result.array_int[0], 1);
     EXPECT_EQ(result.array_int[1], 2);
     EXPECT_EQ(result.array_int[2], 3);
-}
\ No newline at end of file
+}
+
+// case8: 流式unmarshal与Json::Value文档unmarshal结果一致
+TEST_F(AutoJsonTest, TestUnmarshal_case8) {
+    struct Case8Inner : public AutoJsonHelper {
+        int id = 0;
+        double avg_double = 0;
+        std::vector<std::string> array_string;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(id, "innermsg_id");
+            AUTO_JSON_MAPPING(avg_double, "innermsg_avg_double");
+            AUTO_JSON_MAPPING(array_string, "innermsg_array_string");
+        }
+    };
+    struct Case8Struct : public AutoJsonHelper {
+        int id = 0;
+        long id_long = 0;
+        bool flag = false;
+        float ratio = 0;
+        std::string name;
+        double avg_double = 0;
+        std::vector<int> array_int;
+        std::vector<Case8Inner> array_innermsg;
+        std::map<std::string, std::string> map_string_string;
+        std::map<std::string, Case8Inner> map_string_innermsg;
+        std::map<int, int> map_int_int;
+        std::map<long, std::string> map_long_string;
+        Case8Inner innermsg;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(id, "id");
+            AUTO_JSON_MAPPING(id_long, "id_long");
+            AUTO_JSON_MAPPING(flag, "flag");
+            AUTO_JSON_MAPPING(ratio, "ratio");
+            AUTO_JSON_MAPPING(name, "name");
+            AUTO_JSON_MAPPING(avg_double, "avg_double");
+            AUTO_JSON_MAPPING(array_int, "array_int");
+            AUTO_JSON_MAPPING(array_innermsg, "array_innermsg");
+            AUTO_JSON_MAPPING(map_string_string, "map_string_string");
+            AUTO_JSON_MAPPING(map_string_innermsg, "map_string_innermsg");
+            AUTO_JSON_MAPPING(map_int_int, "map_int_int");
+            AUTO_JSON_MAPPING(map_long_string, "map_long_string");
+            AUTO_JSON_MAPPING(innermsg, "innermsg");
+            AUTO_JSON_MAPPING(id_long, "id");
+        }
+    };
+
+    std::vector<std::string> json_strings = {
+        R"({"id":1001,"name":"msg","unknown":{"a":[1,{"b":null}],"c":"}"},"innermsg":{"innermsg_id":7}})",
+        R"( /* comment */ {"name":"中文😀\"\\\/\b\f\n\r\té😀", // comment
+            "avg_double":1e2,"id":2.0,"array_int":[1,-0,3],"map_int_int":{"10":1,"-3":2,"x":3}})",
+        R"({"array_innermsg":[{"innermsg_id":1},{}],"map_string_innermsg":{"a":{"innermsg_id":1},"b":[],"c":{}}})",
+        R"({"array_innermsg":[{"innermsg_id":1},{"innermsg_id":2}],"map_string_string":{"k":"v","n":1},"array_int":null})",
+        R"({"id_long":-9223372036854775808,"avg_double":18446744073709551615,"ratio":0.5,"innermsg":"x","map_long_string":[]})",
+        R"({"id":-2147483648,"name":"dup_1","name":"dup_2","array_int":[],"map_long_string":{"1":"a"},"flag":true})",
+    };
+
+    for (auto &json_string : json_strings) {
+        Case8Struct result;
+        AutoJson::Unmarshal(json_string, result);
+
+        Case8Struct right;
+        Json::Reader reader;
+        Json::Value root;
+        ASSERT_TRUE(reader.parse(json_string, root)) << json_string;
+        right.SetMethod(AutoJsonMethod::Unmarshal);
+        right.SetDocument(root);
+        right.SetJsonMapping();
+
+        std::string result_json;
+        std::string right_json;
+        AutoJson::Marshal(result_json, result);
+        AutoJson::Marshal(right_json, right);
+        EXPECT_EQ(result_json, right_json) << json_string;
+    }
+
+    // 超出int范围的数值按类型不匹配处理
+    Case8Struct result;
+    result.id = 1;
+    std::string json_string = R"({"id":4294967296,"innermsg":{"innermsg_id":1e20}})";
+    AutoJson::Unmarshal(json_string, result);
+    EXPECT_EQ(result.id, 1);
+    EXPECT_EQ(result.id_long, 4294967296L);
+    EXPECT_EQ(result.innermsg.id, 0);
+
+    // 语法错误之前的字段已被赋值
+    json_string = R"({"id":2,"name":"broken" "flag":true})";
+    AutoJson::Unmarshal(json_string, result);
+    EXPECT_EQ(result.id, 2);
+    EXPECT_EQ(result.name, "broken");
+    EXPECT_FALSE(result.flag);
+}
+
+// case9: 直接unmarshal已解析的Json::Value文档
+TEST_F(AutoJsonTest, TestUnmarshal_case9) {
+    std::string json_string = R"({"id":1001,"array_innermsg":[{"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_id":2,"innermsg_array_int":[1,2]}],"map_int_innermsg":{"3":{"innermsg_id":3,"innermsg_array_string":["a"]}},"innermsg":{"innermsg_name":"inner"}})";
+    Json::Reader reader;
+    Json::Value root;
+    ASSERT_TRUE(reader.parse(json_string, root));
+
+    JsonMsg result;
+    AutoJson::Unmarshal(root, result);
+    EXPECT_EQ(result.id, 1001);
+    ASSERT_EQ(result.array_innermsg.size(), 2);
+    EXPECT_EQ(result.array_innermsg[0].id, 1);
+    EXPECT_EQ(result.array_innermsg[0].name, "inner_1");
+    EXPECT_EQ(result.array_innermsg[1].id, 2);
+    ASSERT_EQ(result.array_innermsg[1].array_int.size(), 2);
+    EXPECT_EQ(result.array_innermsg[1].array_int[1], 2);
+    ASSERT_EQ(result.map_int_innermsg.count(3), 1);
+    EXPECT_EQ(result.map_int_innermsg[3].id, 3);
+    ASSERT_EQ(result.map_int_innermsg[3].array_string.size(), 1);
+    EXPECT_EQ(result.map_int_innermsg[3].array_string[0], "a");
+    EXPECT_EQ(result.innermsg.name, "inner");
+
+    // 反序列化后不保留文档副本
+    EXPECT_TRUE(result.GetDocument().isNull());
+    EXPECT_TRUE(result.innermsg.GetDocument().isNull());
+    EXPECT_TRUE(result.array_innermsg[0].GetDocument().isNull());
+}
+
+// case10: 编译期字段表声明的结构体unmarshal
+TEST_F(AutoJsonTest, TestUnmarshal_case10) {
+    std::string json_string = R"({"id":7,"table_msg":{"array_innermsg":[{"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_id":2,"innermsg_array_int":[1,2]}],"id":1001,"innermsg":{"innermsg_id":3},"map_int_innermsg":{"10":{"innermsg_name":"inner_10"}},"name":"msg","unknown":[1,{"a":2}],"table_innermsg":{"innermsg_avg_double":1.5,"innermsg_array_string":["a"]}}})";
+    for (int i = 0; i < 2; ++i) {
+        HelperTableMsg result;
+        if (i == 0) {
+            AutoJson::Unmarshal(json_string, result);
+        } else {
+            Json::Reader reader;
+            Json::Value root;
+            ASSERT_TRUE(reader.parse(json_string, root));
+            AutoJson::Unmarshal(root, result);
+        }
+        EXPECT_EQ(result.id, 7);
+        EXPECT_EQ(result.table_msg.id, 1001);
+        EXPECT_EQ(result.table_msg.name, "msg");
+        ASSERT_EQ(result.table_msg.array_innermsg.size(), 2);
+        EXPECT_EQ(result.table_msg.array_innermsg[0].name, "inner_1");
+        ASSERT_EQ(result.table_msg.array_innermsg[1].array_int.size(), 2);
+        EXPECT_EQ(result.table_msg.array_innermsg[1].array_int[1], 2);
+        EXPECT_EQ(result.table_msg.map_int_innermsg[10].name, "inner_10");
+        EXPECT_EQ(result.table_msg.innermsg.id, 3);
+        EXPECT_EQ(result.table_msg.table_innermsg.avg_double, 1.5);
+        ASSERT_EQ(result.table_msg.table_innermsg.array_string.size(), 1);
+        EXPECT_EQ(result.table_msg.table_innermsg.array_string[0], "a");
+    }
+
+    // 空对象元素使整个数组反序列化失败, 与AutoJsonHelper结构体一致
+    TableMsg result;
+    json_string = R"({"array_innermsg":[{"innermsg_id":1},{}],"id":5})";
+    AutoJson::Unmarshal(json_string, result);
+    EXPECT_EQ(result.id, 5);
+    EXPECT_TRUE(result.array_innermsg.empty());
+}
+
+// case11: 字段较多且json稀疏时按key分发, 包含重复key映射
+struct WideHelperMsg : public AutoJsonHelper {
+    int f0 = 0, f1 = 0, f2 = 0, f3 = 0, f4 = 0, f5 = 0, f6 = 0, f7 = 0, f8 = 0, f9 = 0, f10 = 0, f11 = 0;
+    long f3_copy = 0;
+    std::string quoted;
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(f0, "f0");
+        AUTO_JSON_MAPPING(f1, "f1");
+        AUTO_JSON_MAPPING(f2, "f2");
+        AUTO_JSON_MAPPING(f3, "f3");
+        AUTO_JSON_MAPPING(f4, "f4");
+        AUTO_JSON_MAPPING(f5, "f5");
+        AUTO_JSON_MAPPING(f6, "f6");
+        AUTO_JSON_MAPPING(f7, "f7");
+        AUTO_JSON_MAPPING(f8, "f8");
+        AUTO_JSON_MAPPING(f9, "f9");
+        AUTO_JSON_MAPPING(f10, "f10");
+        AUTO_JSON_MAPPING(f11, "f11");
+        AUTO_JSON_MAPPING(f3_copy, "f3");
+        AUTO_JSON_MAPPING(quoted, "a\"b");
+    }
+};
+
+struct WideTableMsg {
+    int f0 = 0, f1 = 0, f2 = 0, f3 = 0, f4 = 0, f5 = 0, f6 = 0, f7 = 0, f8 = 0, f9 = 0, f10 = 0, f11 = 0;
+    long f3_copy = 0;
+    std::string quoted;
+
+    AUTO_JSON_FIELDS(WideTableMsg,
+                     AUTO_JSON_FIELD(f0, "f0"),
+                     AUTO_JSON_FIELD(f1, "f1"),
+                     AUTO_JSON_FIELD(f2, "f2"),
+                     AUTO_JSON_FIELD(f3, "f3"),
+                     AUTO_JSON_FIELD(f4, "f4"),
+                     AUTO_JSON_FIELD(f5, "f5"),
+                     AUTO_JSON_FIELD(f6, "f6"),
+                     AUTO_JSON_FIELD(f7, "f7"),
+                     AUTO_JSON_FIELD(f8, "f8"),
+                     AUTO_JSON_FIELD(f9, "f9"),
+                     AUTO_JSON_FIELD(f10, "f10"),
+                     AUTO_JSON_FIELD(f11, "f11"),
+                     AUTO_JSON_FIELD(f3_copy, "f3"),
+                     AUTO_JSON_FIELD(quoted, "a\"b"))
+};
+
+template <typename T>
+static void CheckWideMsg(const std::string &json_string) {
+    for (int i = 0; i < 2; ++i) {
+        T result;
+        if (i == 0) {
+            std::string input = json_string;
+            AutoJson::Unmarshal(input, result);
+        } else {
+            Json::Reader reader;
+            Json::Value root;
+            ASSERT_TRUE(reader.parse(json_string, root));
+            AutoJson::Unmarshal(root, result);
+        }
+        EXPECT_EQ(result.f0, 0);
+        EXPECT_EQ(result.f3, 3);
+        EXPECT_EQ(result.f3_copy, 3);
+        EXPECT_EQ(result.f7, 0);
+        EXPECT_EQ(result.f11, 11);
+        EXPECT_EQ(result.quoted, "q");
+    }
+}
+
+TEST_F(AutoJsonTest, TestUnmarshal_case11) {
+    std::string json_string = R"({"x":{"f0":1},"f11":11,"f1x":1,"f":2,"f3":3,"a\"b":"q","\u0066":5})";
+    CheckWideMsg<WideHelperMsg>(json_string);
+    CheckWideMsg<WideTableMsg>(json_string);
+}
+
+// case12: 非侵入式映射声明的结构体unmarshal
+TEST_F(AutoJsonTest, TestUnmarshal_case12) {
+    std::string json_string = R"({"array_innermsg":[{"innermsg_id":1,"innermsg_name":"inner_1"},{"innermsg_array_int":[1,2],"innermsg_id":2}],"id":4294967296,"map_int_innermsg":{"3":{"innermsg_id":3}}})";
+    for (int i = 0; i < 2; ++i) {
+        PlainMsg result{};
+        if (i == 0) {
+            AutoJson::Unmarshal(json_string, result);
+        } else {
+            Json::Reader reader;
+            Json::Value root;
+            ASSERT_TRUE(reader.parse(json_string, root));
+            AutoJson::Unmarshal(root, result);
+        }
+        EXPECT_EQ(result.id, 4294967296L);
+        ASSERT_EQ(result.array_innermsg.size(), 2);
+        EXPECT_EQ(result.array_innermsg[0].name, "inner_1");
+        ASSERT_EQ(result.array_innermsg[1].array_int.size(), 2);
+        EXPECT_EQ(result.array_innermsg[1].array_int[1], 2);
+        EXPECT_EQ(result.map_int_innermsg[3].id, 3);
+    }
+}
+
+// case13: 批量unmarshal json数组或多个json串, 多线程结果一致
+TEST_F(AutoJsonTest, TestUnmarshal_case13) {
+    std::string json_array = "[";
+    for (int i = 0; i < 10; ++i) {
+        json_array += std::string(i == 0 ? "" : " , ") + R"({"innermsg_id":)" + std::to_string(i) + R"(,"innermsg_array_int":[)" + std::to_string(i) + "]}";
+    }
+    json_array += R"(,"not an object",{}])";
+
+    for (size_t parallelism : {1, 3, 0}) {
+        std::vector<TableInnerMsg> objs(1);
+        objs[0].id = 100;
+        // 存在非对象元素时返回false
+        EXPECT_FALSE(AutoJson::UnmarshalMany(json_array, objs, parallelism));
+        ASSERT_EQ(objs.size(), 12);
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_EQ(objs[i].id, i);
+            ASSERT_EQ(objs[i].array_int.size(), 1);
+            EXPECT_EQ(objs[i].array_int[0], i);
+        }
+        // 非对象元素保持默认值
+        EXPECT_EQ(objs[10].id, 0);
+        EXPECT_EQ(objs[11].id, 0);
+    }
+
+    // 语法错误时返回false, 之前的元素被保留
+    std::vector<InnerMsg> objs;
+    EXPECT_FALSE(AutoJson::UnmarshalMany(R"([{"innermsg_id":1},{"innermsg_id":2} {"innermsg_id":3}])", objs, 2));
+    ASSERT_EQ(objs.size(), 2);
+    EXPECT_EQ(objs[1].id, 2);
+    // 根不是数组时返回false, 与空数组区分
+    EXPECT_FALSE(AutoJson::UnmarshalMany("{}", objs));
+    EXPECT_TRUE(objs.empty());
+    EXPECT_TRUE(AutoJson::UnmarshalMany(" [ ] ", objs));
+    EXPECT_TRUE(objs.empty());
+    EXPECT_TRUE(AutoJson::UnmarshalMany(R"([{"innermsg_id":1},{}])", objs, 2));
+    ASSERT_EQ(objs.size(), 2);
+
+    std::vector<std::string> json_strings = {R"({"innermsg_id":1})", "", R"({"innermsg_name":"inner_3"})"};
+    std::vector<TableInnerMsg> results;
+    EXPECT_FALSE(AutoJson::UnmarshalMany(json_strings, results, 2));
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_EQ(results[0].id, 1);
+    EXPECT_EQ(results[1].id, 0);
+    EXPECT_EQ(results[2].name, "inner_3");
+    json_strings[1] = "{}";
+    EXPECT_TRUE(AutoJson::UnmarshalMany(json_strings, results, 2));
+
+    // 多个线程共享调用方的线程池
+    AutoJson::ThreadPool pool(4);
+    std::vector<std::thread> threads;
+    std::vector<int> ok(4);
+    for (size_t t = 0; t < ok.size(); ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<TableInnerMsg> objs;
+            ok[t] = !AutoJson::UnmarshalMany(json_array, objs, pool) && objs.size() == 12 && objs[9].id == 9;
+            std::vector<TableInnerMsg> results;
+            ok[t] = ok[t] && AutoJson::UnmarshalMany(json_strings, results, pool) && results[2].name == "inner_3";
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(ok, std::vector<int>(4, 1));
+}
+
+// case14: 按行读取NDJSON, 跳过空行与超长行
+TEST_F(AutoJsonTest, TestUnmarshal_case14) {
+    std::string long_name(100, 'x');
+    std::string lines = "{\"innermsg_id\":1}\r\n\n   \n{\"innermsg_name\":\"" + long_name + "\"}\n"
+                        "{\"innermsg_array_int\":[1,2]}\n{\"innermsg_id\":4,\"innermsg_name\":\"last\"}";
+
+    // 每次只提供7字节的数据源
+    size_t offset = 0;
+    AutoJson::LineReader chunked([&](char *buf, size_t size) -> size_t {
+        size_t n = std::min<size_t>({size, 7, lines.size() - offset});
+        std::memcpy(buf, lines.data() + offset, n);
+        offset += n;
+        return n;
+    });
+    std::istringstream in(lines);
+    AutoJson::LineReader stream(in, 64);
+    for (AutoJson::LineReader *reader : {&chunked, &stream}) {
+        std::vector<TableInnerMsg> objs;
+        TableInnerMsg obj;
+        while (reader->Next(obj)) {
+            objs.push_back(obj);
+        }
+        bool limited = reader == &stream;
+        ASSERT_EQ(objs.size(), limited ? 3 : 4);
+        EXPECT_EQ(objs[0].id, 1);
+        if (!limited) {
+            EXPECT_EQ(objs[1].name, long_name);
+        }
+        EXPECT_EQ(reader->Skipped(), limited ? 1 : 0);
+        const TableInnerMsg &array_line = objs[objs.size() - 2];
+        ASSERT_EQ(array_line.array_int.size(), 2);
+        // 每行反序列化前对象被重置
+        EXPECT_EQ(array_line.id, 0);
+        EXPECT_EQ(objs.back().id, 4);
+        EXPECT_EQ(objs.back().name, "last");
+    }
+
+    std::FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    std::fwrite(lines.data(), 1, lines.size(), file);
+    std::fflush(file);
+    std::rewind(file);
+    AutoJson::LineReader reader(fileno(file));
+    InnerMsg obj;
+    size_t count = 0;
+    while (reader.Next(obj)) {
+        ++count;
+    }
+    EXPECT_EQ(count, 4);
+    EXPECT_EQ(obj.name, "last");
+    EXPECT_FALSE(reader.Failed());
+    std::fclose(file);
+}
+
+// case15: 从原始缓冲区/string_view/文件直接unmarshal, 不越过缓冲区末尾
+TEST_F(AutoJsonTest, TestUnmarshal_case15) {
+    const std::string buffer = R"({"innermsg_id":12,"innermsg_name":"inner"})";
+    TableInnerMsg result;
+    AutoJson::Unmarshal(buffer.data(), buffer.size(), result);
+    EXPECT_EQ(result.id, 12);
+    EXPECT_EQ(result.name, "inner");
+
+    // 只解析缓冲区前缀, 数字在缓冲区末尾截断
+    result = TableInnerMsg();
+    AutoJson::Unmarshal(buffer.data(), 16, result);
+    EXPECT_EQ(result.id, 1);
+    EXPECT_EQ(result.name, "");
+
+    result = TableInnerMsg();
+    AutoJson::Unmarshal(R"({"innermsg_name":"literal"})", result);
+    EXPECT_EQ(result.name, "literal");
+
+    const std::string const_string = R"({"innermsg_id":3})";
+    AutoJson::Unmarshal(const_string, result);
+    EXPECT_EQ(result.id, 3);
+
+#if __cplusplus >= 201703L
+    std::string_view view(buffer);
+    result = TableInnerMsg();
+    AutoJson::Unmarshal(view.substr(0, 17), result);
+    EXPECT_EQ(result.id, 12);
+    EXPECT_EQ(result.name, "");
+#endif
+
+    std::string json_array = R"([{"innermsg_id":1},{"innermsg_id":2}])";
+    std::vector<TableInnerMsg> objs;
+    EXPECT_TRUE(AutoJson::UnmarshalMany(json_array.data(), json_array.size(), objs));
+    ASSERT_EQ(objs.size(), 2);
+    EXPECT_EQ(objs[1].id, 2);
+
+    char path[] = "/tmp/auto_json_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, buffer.data(), buffer.size()), static_cast<ssize_t>(buffer.size()));
+    close(fd);
+    result = TableInnerMsg();
+    EXPECT_TRUE(AutoJson::UnmarshalFile(path, result));
+    EXPECT_EQ(result.id, 12);
+    EXPECT_EQ(result.name, "inner");
+    AutoJson::MappedFile file(path);
+    ASSERT_TRUE(file.IsOpen());
+    EXPECT_EQ(std::string(file.Data(), file.Size()), buffer);
+    std::remove(path);
+    EXPECT_FALSE(AutoJson::UnmarshalFile(path, result));
+}
+
+// case17: unordered_map与有序vector<pair>作为map, 整数key原地解析
+TEST_F(AutoJsonTest, TestUnmarshal_case17) {
+    struct HashMsg : public AutoJsonHelper {
+        std::unordered_map<std::string, int> hash_string_int;
+        std::unordered_map<int, std::string> hash_int_string;
+        std::unordered_map<long, InnerMsg> hash_long_inner;
+        std::vector<std::pair<std::string, int>> flat_string_int;
+        std::vector<std::pair<int, std::string>> flat_int_string;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(hash_string_int, "hash_string_int");
+            AUTO_JSON_MAPPING(hash_int_string, "hash_int_string");
+            AUTO_JSON_MAPPING(hash_long_inner, "hash_long_inner");
+            AUTO_JSON_MAPPING(flat_string_int, "flat_string_int");
+            AUTO_JSON_MAPPING(flat_int_string, "flat_int_string");
+        }
+    };
+    // 同样内容的std::map, 输出的key顺序与之一致
+    struct TreeMsg : public AutoJsonHelper {
+        std::map<std::string, int> hash_string_int;
+        std::map<int, std::string> hash_int_string;
+        std::map<long, InnerMsg> hash_long_inner;
+        std::map<std::string, int> flat_string_int;
+        std::map<int, std::string> flat_int_string;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(hash_string_int, "hash_string_int");
+            AUTO_JSON_MAPPING(hash_int_string, "hash_int_string");
+            AUTO_JSON_MAPPING(hash_long_inner, "hash_long_inner");
+            AUTO_JSON_MAPPING(flat_string_int, "flat_string_int");
+            AUTO_JSON_MAPPING(flat_int_string, "flat_int_string");
+        }
+    };
+
+    HashMsg msg;
+    TreeMsg tree;
+    for (int i = 0; i < 50; ++i) {
+        std::string key = "key_" + std::to_string(i * 7 % 50);
+        msg.hash_string_int[key] = i;
+        tree.hash_string_int[key] = i;
+        msg.hash_int_string[i * 37 - 900] = key;
+        tree.hash_int_string[i * 37 - 900] = key;
+    }
+    InnerMsg inner;
+    inner.reset();
+    inner.id = 3;
+    inner.name = "inner";
+    msg.hash_long_inner[-9223372036854775807L - 1] = inner;
+    tree.hash_long_inner[-9223372036854775807L - 1] = inner;
+    msg.flat_string_int = {{"a", 1}, {"b", 2}, {"c", 3}};
+    tree.flat_string_int = {{"a", 1}, {"b", 2}, {"c", 3}};
+    msg.flat_int_string = {{2, "two"}, {9, "nine"}, {10, "ten"}};
+    tree.flat_int_string = {{2, "two"}, {9, "nine"}, {10, "ten"}};
+
+    std::string json_string;
+    AutoJson::Marshal(json_string, msg);
+    std::string tree_json;
+    AutoJson::Marshal(tree_json, tree);
+    EXPECT_EQ(json_string, tree_json);
+    Json::Value root;
+    AutoJson::Marshal(root, msg);
+    EXPECT_EQ(Json::FastWriter().write(root), json_string + "\n");
+
+    HashMsg stream_result;
+    AutoJson::Unmarshal(json_string, stream_result);
+    HashMsg document_result;
+    AutoJson::Unmarshal(root, document_result);
+    for (const HashMsg *result : {&stream_result, &document_result}) {
+        EXPECT_EQ(result->hash_string_int, msg.hash_string_int);
+        EXPECT_EQ(result->hash_int_string, msg.hash_int_string);
+        ASSERT_EQ(result->hash_long_inner.size(), 1);
+        EXPECT_EQ(result->hash_long_inner.at(-9223372036854775807L - 1).name, "inner");
+        EXPECT_EQ(result->flat_string_int, msg.flat_string_int);
+        EXPECT_EQ(result->flat_int_string, msg.flat_int_string);
+    }
+
+    // 有序vector按key排序, 重复key保留最后一个值; 整数key与atol的转换一致
+    std::string flat_json = R"({"flat_int_string":{" 12":"space","+3":"plus","abc":"zero","10":"ten",)"
+                            R"("99999999999":"overflow","3":"dup","-1":"neg"},)"
+                            R"("flat_string_int":{"b":2,"a":1,"c":"not int","a":7}})";
+    Json::Value flat_root;
+    ASSERT_TRUE(Json::Reader().parse(flat_json, flat_root));
+    HashMsg flat_stream;
+    AutoJson::Unmarshal(flat_json, flat_stream);
+    HashMsg flat_document;
+    AutoJson::Unmarshal(flat_root, flat_document);
+    std::vector<std::pair<int, std::string>> right_int{{-1, "neg"}, {0, "zero"}, {3, "dup"}, {10, "ten"}, {12, "space"},
+                                                       {static_cast<int>(atol("99999999999")), "overflow"}};
+    std::sort(right_int.begin(), right_int.end());
+    EXPECT_EQ(flat_stream.flat_int_string, right_int);
+    // 文档中key有序, "+3"先于"3"
+    EXPECT_EQ(flat_document.flat_int_string, right_int);
+    // 值类型不匹配的int保持默认值0
+    EXPECT_EQ(flat_stream.flat_string_int, (std::vector<std::pair<std::string, int>>{{"a", 7}, {"b", 2}, {"c", 0}}));
+    EXPECT_EQ(flat_document.flat_string_int, (std::vector<std::pair<std::string, int>>{{"a", 7}, {"b", 2}, {"c", 0}}));
+
+    // 大量整数key
+    HashMsg large;
+    for (int i = 0; i < 100000; ++i) {
+        large.hash_int_string[i * 3 - 150000] = std::to_string(i);
+    }
+    AutoJson::Marshal(json_string, large);
+    HashMsg large_result;
+    AutoJson::Unmarshal(json_string, large_result);
+    EXPECT_EQ(large_result.hash_int_string, large.hash_int_string);
+}
+
+// case18: 复用对象反复unmarshal, 保留容器容量, 结果与新对象一致
+TEST_F(AutoJsonTest, TestUnmarshal_case18) {
+    struct ReuseMsg : public AutoJsonHelper {
+        std::vector<InnerMsg> inners;
+        std::vector<std::string> names;
+        std::map<std::string, InnerMsg> tree;
+        std::unordered_map<int, std::string> hash;
+        std::vector<std::pair<std::string, int>> flat;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(inners, "inners");
+            AUTO_JSON_MAPPING(names, "names");
+            AUTO_JSON_MAPPING(tree, "tree");
+            AUTO_JSON_MAPPING(hash, "hash");
+            AUTO_JSON_MAPPING(flat, "flat");
+        }
+    };
+    auto make = [](int count, int seed) {
+        ReuseMsg msg;
+        for (int i = 0; i < count; ++i) {
+            InnerMsg inner;
+            inner.reset();
+            inner.id = seed + i;
+            inner.name = std::string(40, static_cast<char>('a' + i % 26));
+            inner.array_int = std::vector<int>(i + 1, seed);
+            msg.inners.push_back(inner);
+            msg.names.push_back(std::string(30 + i, 'n'));
+            msg.tree["key_" + std::to_string((seed + i) % 5)] = inner;
+            msg.hash[(seed + i) % 7] = std::to_string(i);
+            msg.flat.emplace_back("flat_" + std::to_string((seed + i) % 6), i);
+        }
+        std::sort(msg.flat.begin(), msg.flat.end());
+        msg.flat.erase(std::unique(msg.flat.begin(), msg.flat.end(),
+                                   [](const std::pair<std::string, int> &a, const std::pair<std::string, int> &b) {
+                                       return a.first == b.first;
+                                   }), msg.flat.end());
+        return msg;
+    };
+
+    ReuseMsg result;
+    AutoJson::Codec codec;
+    std::string json_string;
+    for (int count : {5, 3, 5, 8, 1, 4}) {
+        ReuseMsg msg = make(count, count * 3);
+        AutoJson::Marshal(json_string, msg);
+        const InnerMsg *inners = result.inners.data();
+        size_t inners_capacity = result.inners.capacity();
+        const char *first_name = result.names.empty() ? nullptr : result.names[0].data();
+        bool shrinks = count <= static_cast<int>(result.inners.size());
+        if (count % 2 == 0) {
+            codec.UnmarshalReuse(json_string, result);
+        } else {
+            AutoJson::UnmarshalReuse(json_string, result);
+        }
+        ReuseMsg fresh;
+        AutoJson::Unmarshal(json_string, fresh);
+        std::string result_json;
+        std::string fresh_json;
+        AutoJson::Marshal(result_json, result);
+        AutoJson::Marshal(fresh_json, fresh);
+        EXPECT_EQ(result_json, fresh_json);
+        ASSERT_EQ(result.inners.size(), static_cast<size_t>(count));
+        // 不超过已有大小时元素原地解码, 不重新分配
+        if (shrinks) {
+            EXPECT_EQ(result.inners.data(), inners);
+            EXPECT_EQ(result.inners.capacity(), inners_capacity);
+            EXPECT_EQ(result.names[0].data(), first_name);
+        }
+        // 输入中不存在的key被删除
+        EXPECT_EQ(result.tree.size(), fresh.tree.size());
+        EXPECT_EQ(result.hash, fresh.hash);
+        EXPECT_EQ(result.flat, fresh.flat);
+    }
+
+    // 已有map节点原地解码, 输入中没有的成员保留原值
+    ASSERT_FALSE(result.tree.empty());
+    const InnerMsg *node = &result.tree.begin()->second;
+    std::string node_key = result.tree.begin()->first;
+    std::string node_name = node->name;
+    std::string reuse_json = R"({"tree":{")" + node_key + R"(":{"innermsg_id":7},"key_9":{"innermsg_id":9}}})";
+    AutoJson::UnmarshalReuse(reuse_json, result);
+    ASSERT_EQ(result.tree.size(), 2);
+    EXPECT_EQ(&result.tree.at(node_key), node);
+    EXPECT_EQ(result.tree.at(node_key).id, 7);
+    EXPECT_EQ(result.tree.at(node_key).name, node_name);
+    EXPECT_EQ(result.tree.at("key_9").id, 9);
+
+    // 空数组与空对象清空容器, 类型不匹配时保留原值
+    AutoJson::UnmarshalReuse(R"({"inners":[],"tree":{},"flat":"not object","names":null})", result);
+    EXPECT_TRUE(result.inners.empty());
+    EXPECT_TRUE(result.tree.empty());
+    EXPECT_FALSE(result.flat.empty());
+    EXPECT_FALSE(result.names.empty());
+}
+
+// case19: 懒解析视图只解码访问到的字段
+TEST_F(AutoJsonTest, TestUnmarshal_case19) {
+    JsonMsg msg;
+    msg.id = 1001;
+    msg.name = "envelope";
+    msg.avg_double = pai;
+    msg.array_string = {"a", "b"};
+    msg.array_int = {1, 2, 3};
+    msg.innermsg.reset();
+    msg.innermsg.id = 7;
+    msg.innermsg.name = "inner";
+    for (int i = 0; i < 100; ++i) {
+        InnerMsg inner;
+        inner.reset();
+        inner.id = i;
+        inner.name = std::string(20, 'x');
+        msg.array_innermsg.push_back(inner);
+        msg.map_int_innermsg[i] = inner;
+    }
+    std::string json_string;
+    AutoJson::Marshal(json_string, msg);
+
+    AutoJson::View<JsonMsg> view(json_string);
+    ASSERT_TRUE(view.Valid());
+    EXPECT_EQ(view.Get(&JsonMsg::id), 1001);
+    EXPECT_EQ(view.Get(&JsonMsg::name), "envelope");
+    EXPECT_DOUBLE_EQ(view.Get(&JsonMsg::avg_double), pai);
+    EXPECT_EQ(view.Get(&JsonMsg::array_int), msg.array_int);
+    EXPECT_EQ(view.Get(&JsonMsg::array_innermsg).size(), 100);
+    EXPECT_TRUE(view.Has(&JsonMsg::map_int_innermsg));
+    // 嵌套对象的视图不解码其余字段
+    AutoJson::View<InnerMsg> inner = view.Sub(&JsonMsg::innermsg);
+    EXPECT_EQ(inner.Get(&InnerMsg::id), 7);
+    EXPECT_EQ(inner.Get(&InnerMsg::name), "inner");
+    EXPECT_FALSE(view.Sub(&JsonMsg::map_int_int).Valid());
+
+    // 类型不匹配时不修改结果, 重复key取最后一个, key中的转义被解码
+    std::string edge_json = R"({"innermsg_id":"1","innermsg_name":"a","innermsg_name":"b",)"
+                            R"("innermsg_arr\u0061y_int":[1,2]})";
+    AutoJson::View<InnerMsg> edge(edge_json);
+    int id = 5;
+    EXPECT_TRUE(edge.Get(&InnerMsg::id, id));
+    EXPECT_EQ(id, 5);
+    EXPECT_EQ(edge.Get(&InnerMsg::name), "b");
+    std::vector<int> array_int;
+    EXPECT_TRUE(edge.Get(&InnerMsg::array_int, array_int));
+    EXPECT_EQ(array_int, (std::vector<int>{1, 2}));
+    EXPECT_FALSE(edge.Has(&InnerMsg::array_string));
+
+    // 语法错误之前的字段仍可访问
+    std::string broken = R"({"innermsg_id":3,"innermsg_name":"c","innermsg_array_int":[1,)";
+    AutoJson::View<InnerMsg> broken_view(broken.data(), broken.size());
+    EXPECT_FALSE(broken_view.Valid());
+    EXPECT_EQ(broken_view.Get(&InnerMsg::id), 3);
+    EXPECT_EQ(broken_view.Get(&InnerMsg::name), "c");
+    EXPECT_FALSE(broken_view.Has(&InnerMsg::array_int));
+    std::string array_json = "[1,2]";
+    EXPECT_FALSE(AutoJson::View<InnerMsg>(array_json).Valid());
+    EXPECT_FALSE(AutoJson::View<InnerMsg>().Valid());
+
+    // 编译期字段表声明的类型
+    TableMsg table;
+    table.id = 9;
+    table.name = "table";
+    table.table_innermsg.id = 11;
+    AutoJson::Marshal(json_string, table);
+    AutoJson::View<TableMsg> table_view(json_string);
+    EXPECT_EQ(table_view.Get(&TableMsg::id), 9);
+    EXPECT_EQ(table_view.Get(&TableMsg::name), "table");
+    EXPECT_EQ(table_view.Sub(&TableMsg::table_innermsg).Get(&TableInnerMsg::id), 11);
+}
+
+// case20: 按字段掩码只unmarshal选中的字段
+TEST_F(AutoJsonTest, TestUnmarshal_case20) {
+    std::string json_string = R"({"id":1001,"name":"name","avg_double":1.5,)"
+                              R"("innermsg":{"innermsg_id":7,"innermsg_name":"inner"},)"
+                              R"("array_innermsg":[{"innermsg_id":1,"innermsg_name":"a"},{"innermsg_id":2}],)"
+                              R"("map_string_int":{"a":1}})";
+    JsonMsg result;
+    result.id = 0;
+    result.name = "origin";
+    result.avg_double = 0;
+    result.innermsg.reset();
+    result.innermsg.name = "origin_inner";
+    AutoJson::Unmarshal(json_string, result,
+                        AutoJson::FieldMask{"id", "innermsg.innermsg_id", "array_innermsg.innermsg_id"});
+    EXPECT_EQ(result.id, 1001);
+    EXPECT_EQ(result.name, "origin");
+    EXPECT_DOUBLE_EQ(result.avg_double, 0);
+    EXPECT_EQ(result.innermsg.id, 7);
+    EXPECT_EQ(result.innermsg.name, "origin_inner");
+    ASSERT_EQ(result.array_innermsg.size(), 2);
+    EXPECT_EQ(result.array_innermsg[0].id, 1);
+    EXPECT_EQ(result.array_innermsg[0].name, "");
+    EXPECT_EQ(result.array_innermsg[1].id, 2);
+    EXPECT_TRUE(result.map_string_int.empty());
+
+    // 与完整unmarshal后的对应字段一致
+    TableMsg table;
+    std::string table_json = R"({"id":9,"name":"table","table_innermsg":{"innermsg_id":11,"innermsg_name":"x"}})";
+    AutoJson::Unmarshal(table_json.data(), table_json.size(), table,
+                        AutoJson::FieldMask{"name", "table_innermsg.innermsg_id"});
+    EXPECT_EQ(table.id, 0);
+    EXPECT_EQ(table.name, "table");
+    EXPECT_EQ(table.table_innermsg.id, 11);
+    EXPECT_EQ(table.table_innermsg.name, "");
+}
+
+// case21: unmarshal MessagePack, 类型不匹配与截断的输入
+TEST_F(AutoJsonTest, TestUnmarshal_case21) {
+    // 类型不匹配的字段保持原值, 未知字段中的各种类型被跳过
+    std::string packed = "\x87";
+    packed += "\xa7" "unknown" "\x92\xc7\x02\x01\xff\xff\xd6\x01" "abcd";
+    packed += "\xab" "innermsg_id" "\xa1" "x";
+    packed += "\xad" "innermsg_name" "\x2a";
+    packed += "\xb3" "innermsg_avg_double" "\xd0\xfe";
+    packed += "\xb5" "innermsg_array_string" "\x92\xa1" "a" "\xc4\x01" "b";
+    packed += "\xb2" "innermsg_array_int" "\x93\x01\xcb\x40" + std::string(7, '\0') + "\xcf" + std::string(8, '\xff');
+    packed += "\x01\x02";
+    InnerMsg result;
+    result.reset();
+    result.id = 5;
+    result.name = "origin";
+    result.array_string = {"origin"};
+    AutoJson::UnmarshalMsgPack(packed, result);
+    EXPECT_EQ(result.id, 5);
+    EXPECT_EQ(result.name, "origin");
+    EXPECT_DOUBLE_EQ(result.avg_double, -2);
+    // 字符串数组中的bin元素被忽略, 与JSON中类型不匹配的元素一致
+    EXPECT_EQ(result.array_string, (std::vector<std::string>{"a", ""}));
+    // 2.0可以无损转换为int, 超出范围的uint64被忽略
+    EXPECT_EQ(result.array_int, (std::vector<int>{1, 2, 0}));
+
+    // 整数key的map接受字符串key
+    struct MapMsg : public AutoJsonHelper {
+        std::map<int, std::string> map_int_string;
+        std::unordered_map<std::string, int> hash_string_int;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(map_int_string, "map_int_string");
+            AUTO_JSON_MAPPING(hash_string_int, "hash_string_int");
+        }
+    };
+    packed = "\x82";
+    packed += "\xae" "map_int_string" "\x83\x01\xa3" "one" "\xa2" "-2" "\xa3" "two" "\xcb" + std::string(8, '\0') + "\xa1" "z";
+    packed += "\xaf" "hash_string_int" "\x82\x07\x01\xa1" "a" "\x02";
+    MapMsg map_result;
+    AutoJson::UnmarshalMsgPack(packed, map_result);
+    EXPECT_EQ(map_result.map_int_string, (std::map<int, std::string>{{1, "one"}, {-2, "two"}}));
+    EXPECT_EQ(map_result.hash_string_int, (std::unordered_map<std::string, int>{{"a", 2}}));
+
+    // 截断的输入: 之前的字段保留, 不越过缓冲区末尾
+    InnerMsg inner;
+    inner.reset();
+    inner.id = 3;
+    inner.name = std::string(100, 'n');
+    inner.array_int = {1, 2, 3};
+    AutoJson::MarshalMsgPack(packed, inner);
+    for (size_t length = 0; length < packed.size(); ++length) {
+        std::vector<char> buffer(packed.begin(), packed.begin() + length);
+        InnerMsg truncated;
+        truncated.reset();
+        AutoJson::UnmarshalMsgPack(buffer.data(), buffer.size(), truncated);
+    }
+    // 伪造的超大长度不会预先分配
+    std::string forged = "\x81\xb2" "innermsg_array_int" "\xdd\xff\xff\xff\xff\x01";
+    InnerMsg forged_result;
+    forged_result.reset();
+    AutoJson::UnmarshalMsgPack(forged, forged_result);
+    EXPECT_TRUE(forged_result.array_int.empty());
+}
+
+// case22: 对象与各类map中的重复key均以最后一个值为准
+TEST_F(AutoJsonTest, TestUnmarshal_case22) {
+    struct DupMsg : public AutoJsonHelper {
+        std::unordered_map<std::string, int> hash_string_int;
+        std::unordered_map<int, std::string> hash_int_string;
+        std::vector<std::pair<int, int>> flat_int_int;
+
+        void SetJsonMapping() override {
+            AUTO_JSON_MAPPING(hash_string_int, "hash_string_int");
+            AUTO_JSON_MAPPING(hash_int_string, "hash_int_string");
+            AUTO_JSON_MAPPING(flat_int_int, "flat_int_int");
+        }
+    };
+    std::string json_string = R"({"id":1,"map_string_int":{"a":1,"b":5,"a":2},"map_int_int":{"5":1,"5":2},)"
+                              R"("map_string_innermsg":{"k":{"innermsg_id":1,"innermsg_name":"first"},"k":{"innermsg_id":2}},)"
+                              R"("id":3})";
+    Json::Value root;
+    ASSERT_TRUE(Json::Reader().parse(json_string, root));
+    JsonMsg stream_result;
+    AutoJson::Unmarshal(json_string, stream_result);
+    JsonMsg document_result;
+    AutoJson::Unmarshal(root, document_result);
+    JsonMsg reuse_result;
+    reuse_result.map_string_int["a"] = 100;
+    reuse_result.map_string_innermsg["k"].name = "old";
+    AutoJson::UnmarshalReuse(json_string, reuse_result);
+    for (const JsonMsg *result : {&stream_result, &document_result, &reuse_result}) {
+        EXPECT_EQ(result->id, 3);
+        EXPECT_EQ(result->map_string_int, (std::map<std::string, int>{{"a", 2}, {"b", 5}}));
+        EXPECT_EQ(result->map_int_int, (std::map<int, int>{{5, 2}}));
+        ASSERT_EQ(result->map_string_innermsg.size(), 1);
+        EXPECT_EQ(result->map_string_innermsg.at("k").id, 2);
+    }
+    // 非复用模式下重复key得到新值, 不与之前的值合并
+    EXPECT_EQ(stream_result.map_string_innermsg.at("k").name, "");
+    EXPECT_EQ(document_result.map_string_innermsg.at("k").name, "");
+
+    std::string hash_json = R"({"hash_string_int":{"x":1,"y":0,"x":2},"hash_int_string":{"7":"a","7":"b"},)"
+                            R"("flat_int_int":{"3":1,"1":9,"3":2,"3":3}})";
+    DupMsg hash_result;
+    AutoJson::Unmarshal(hash_json, hash_result);
+    EXPECT_EQ(hash_result.hash_string_int, (std::unordered_map<std::string, int>{{"x", 2}, {"y", 0}}));
+    EXPECT_EQ(hash_result.hash_int_string, (std::unordered_map<int, std::string>{{7, "b"}}));
+    EXPECT_EQ(hash_result.flat_int_int, (std::vector<std::pair<int, int>>{{1, 9}, {3, 3}}));
+
+    // 重复key的新值类型不匹配时, 该key被移除
+    std::string mismatch_json = R"({"map_string_innermsg":{"k":{"innermsg_id":1},"k":5}})";
+    JsonMsg mismatch_result;
+    AutoJson::Unmarshal(mismatch_json, mismatch_result);
+    EXPECT_TRUE(mismatch_result.map_string_innermsg.empty());
+}
+
+// case23: 非法输入返回false, 出错前的字段保留新值, 按行读取时跳过非法行
+TEST_F(AutoJsonTest, TestUnmarshal_case23) {
+    TableInnerMsg result;
+    EXPECT_TRUE(AutoJson::Unmarshal(R"({"innermsg_id":1,"innermsg_name":"ok"})", result));
+    EXPECT_EQ(result.id, 1);
+    EXPECT_TRUE(AutoJson::Unmarshal("{}", result));
+    EXPECT_EQ(result.id, 1);
+
+    // 截断与语法错误: 出错前的字段已被赋值
+    TableInnerMsg truncated;
+    EXPECT_FALSE(AutoJson::Unmarshal(R"({"innermsg_id":5)", truncated));
+    EXPECT_EQ(truncated.id, 5);
+    TableInnerMsg broken;
+    EXPECT_FALSE(AutoJson::Unmarshal(R"({"innermsg_id":9,"innermsg_name":"ok", bad})", broken));
+    EXPECT_EQ(broken.id, 9);
+    EXPECT_EQ(broken.name, "ok");
+
+    // 根不是对象或输入为空时对象不变
+    TableInnerMsg untouched;
+    untouched.id = 7;
+    EXPECT_FALSE(AutoJson::Unmarshal("", untouched));
+    EXPECT_FALSE(AutoJson::Unmarshal("[1,2]", untouched));
+    EXPECT_FALSE(AutoJson::UnmarshalReuse(std::string("42"), untouched));
+    EXPECT_EQ(untouched.id, 7);
+
+    AutoJson::Codec codec;
+    EXPECT_TRUE(codec.Unmarshal(std::string(R"({"innermsg_id":3})"), result));
+    EXPECT_FALSE(codec.Unmarshal(std::string(R"({"innermsg_id":)"), result));
+
+    std::string packed;
+    AutoJson::MarshalMsgPack(packed, result);
+    TableInnerMsg unpacked;
+    EXPECT_TRUE(AutoJson::UnmarshalMsgPack(packed, unpacked));
+    EXPECT_FALSE(AutoJson::UnmarshalMsgPack(packed.data(), packed.size() - 1, unpacked));
+
+    // 截断的行被跳过并计数, 不会得到只填了一半的记录
+    std::istringstream in("{\"innermsg_id\":1}\n{\"innermsg_id\":2,\"innermsg_na\n[3]\n{\"innermsg_id\":4}\n{\"innermsg_id\":5");
+    AutoJson::LineReader reader(in);
+    std::vector<int> ids;
+    TableInnerMsg obj;
+    while (reader.Next(obj)) {
+        ids.push_back(obj.id);
+    }
+    EXPECT_EQ(ids, (std::vector<int>{1, 4}));
+    EXPECT_EQ(reader.Rejected(), 3);
+    EXPECT_EQ(obj.id, 0);
+}
+
+#if __cplusplus >= 201703L
+// 成员全部从构造时传入的memory_resource分配
+struct PmrMsg : public AutoJsonHelper {
+    int id = 0;
+    std::pmr::string name;
+    std::pmr::vector<std::pmr::string> array_string;
+    std::pmr::map<std::pmr::string, std::pmr::vector<int>> map_string_array;
+    std::pmr::map<int, std::pmr::string> map_int_string;
+
+    explicit PmrMsg(std::pmr::memory_resource *arena)
+        : name(arena), array_string(arena), map_string_array(arena), map_int_string(arena) {}
+
+    void SetJsonMapping() override {
+        AUTO_JSON_MAPPING(id, "id");
+        AUTO_JSON_MAPPING(name, "name");
+        AUTO_JSON_MAPPING(array_string, "array_string");
+        AUTO_JSON_MAPPING(map_string_array, "map_string_array");
+        AUTO_JSON_MAPPING(map_int_string, "map_int_string");
+    }
+};
+
+// 统计从上游分配的字节数
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocated = 0;
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        allocated += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// case16: std::pmr容器与字符串从调用方提供的arena分配
+TEST_F(AutoJsonTest, TestUnmarshal_case16) {
+    std::string json_string = R"({"array_string":["a string longer than the small string buffer","b"],)"
+                              R"("id":7,"map_int_string":{"1":"one","10":"a value longer than the small string buffer"},)"
+                              R"("map_string_array":{"a key longer than the small string buffer":[1,2,3],"k":[]},)"
+                              R"("name":"a name longer than the small string buffer"})";
+    CountingResource upstream;
+    std::pmr::monotonic_buffer_resource arena(&upstream);
+    // 任何不经过arena的pmr分配都会抛出bad_alloc
+    std::pmr::memory_resource *previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    {
+        PmrMsg stream_result(&arena);
+        AutoJson::Unmarshal(json_string, stream_result);
+        PmrMsg document_result(&arena);
+        Json::Value root;
+        ASSERT_TRUE(Json::Reader().parse(json_string, root));
+        AutoJson::Unmarshal(root, document_result);
+        std::pmr::set_default_resource(previous);
+
+        for (const PmrMsg *result : {&stream_result, &document_result}) {
+            EXPECT_EQ(result->id, 7);
+            EXPECT_EQ(result->name, "a name longer than the small string buffer");
+            ASSERT_EQ(result->array_string.size(), 2);
+            EXPECT_EQ(result->array_string[0], "a string longer than the small string buffer");
+            EXPECT_EQ(result->array_string[0].get_allocator().resource(), &arena);
+            ASSERT_EQ(result->map_string_array.size(), 2);
+            const auto &array = result->map_string_array.begin()->second;
+            EXPECT_EQ(array, std::pmr::vector<int>({1, 2, 3}));
+            EXPECT_EQ(array.get_allocator().resource(), &arena);
+            EXPECT_EQ(result->map_string_array.begin()->first.get_allocator().resource(), &arena);
+            ASSERT_EQ(result->map_int_string.size(), 2);
+            EXPECT_EQ(result->map_int_string.at(10), "a value longer than the small string buffer");
+            EXPECT_EQ(result->map_int_string.at(10).get_allocator().resource(), &arena);
+
+            // 空数组marshal为null
+            std::string right_json = json_string;
+            right_json.replace(right_json.find("\"k\":[]"), 6, "\"k\":null");
+            std::string marshaled;
+            AutoJson::Marshal(marshaled, *result);
+            EXPECT_EQ(marshaled, right_json);
+            Json::Value document;
+            AutoJson::Marshal(document, *result);
+            EXPECT_EQ(Json::FastWriter().write(document), right_json + "\n");
+        }
+        EXPECT_GT(upstream.allocated, 0);
+    }
+    std::pmr::set_default_resource(previous);
+    // 整个对象图随arena一次释放
+    arena.release();
+}
+#endif